@@ -0,0 +1,1460 @@
+/*** Includes ***/
+#define _DEFAULT_SOURCE 1       // expose POSIX/BSD extensions under -std=c99
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <errno.h>      // EAGAIN when the key script runs dry
+#include <poll.h>       // struct pollfd for the poll() wrapper
+#include <pthread.h>    // pthread_self() to tell the frame threads apart
+#include <sched.h>      // sched_yield() while the highlighter works
+#include <signal.h>     // SIGALRM for the replay watchdog
+#include <stdio.h>      // printf(), fopen()
+#include <stdlib.h>     // malloc(), qsort(), mkstemps()
+#include <string.h>     // memcpy(), strcmp()
+#include <sys/ioctl.h>  // TIOCGWINSZ, struct winsize
+#include <sys/resource.h> // getrusage() for peak memory
+#include <time.h>       // clock_gettime()
+#include <unistd.h>     // read(), write(), unlink()
+
+/* kilo-bench runs the editor headless. kilo.c is compiled into this file
+   with its terminal syscalls routed through the wrappers below: stdin is
+   fed from a key script, stdout is captured and replayed into an in-memory
+   VT, and every call is counted. Each keystroke is timed from the moment
+   its bytes are readable until its frame has been written. */
+
+/*** Terminal Stubs ***/
+struct benchIO {
+    const char *in;                 // key bytes the editor has not read yet
+    size_t inlen;
+    char *out;                      // editor output since the last step
+    size_t outlen, outcap;
+    unsigned long syscalls;         // calls the editor made, from any thread
+    int rows, cols;                 // terminal size reported by ioctl()
+    size_t wmax;                    // -w: longest write() the terminal accepts
+    int wblock;                     // next short write fails with EAGAIN first
+};
+
+struct benchIO B;
+
+void benchCount(void) {                     // count a syscall made by the editor
+    __atomic_fetch_add(&B.syscalls, 1, __ATOMIC_RELAXED); // the render thread counts too
+}
+
+ssize_t benchRead(int fd, void *buf, size_t len) { // stdin comes from the key script
+    benchCount();
+    if (fd != STDIN_FILENO) return read(fd, buf, len);
+    if (B.inlen == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (len > B.inlen) len = B.inlen;
+    memcpy(buf, B.in, len);
+    B.in += len;
+    B.inlen -= len;
+    return len;
+}
+
+ssize_t benchWrite(int fd, const void *buf, size_t len) { // stdout is captured
+    benchCount();
+    if (fd != STDOUT_FILENO) return write(fd, buf, len);
+    if (B.wmax && len > B.wmax) {          // a slow terminal: short writes and EAGAIN
+        if ((B.wblock = !B.wblock)) {
+            errno = EAGAIN;
+            return -1;
+        }
+        len = B.wmax;
+    }
+    if (B.outlen + len > B.outcap) {
+        B.outcap = (B.outlen + len) * 2;
+        B.out = realloc(B.out, B.outcap);
+        if (B.out == NULL) abort();
+    }
+    memcpy(B.out + B.outlen, buf, len);
+    B.outlen += len;
+    return len;
+}
+
+int benchPoll(struct pollfd *fds, nfds_t n, int timeout) { // never blocks
+    nfds_t i, in = n, out = n;
+    int ready;
+    (void)timeout;                          // the script is all there is
+    benchCount();
+    for (i = 0; i < n; i++) {
+        if (fds[i].fd == STDIN_FILENO) in = i;
+        else if (fds[i].fd == STDOUT_FILENO) out = i;
+        else continue;
+        fds[i].fd = -1;                     // poll() skips negative descriptors
+    }
+    ready = poll(fds, n, 0);
+    if (ready < 0) ready = 0;
+    if (in < n) {
+        fds[in].fd = STDIN_FILENO;
+        fds[in].revents = B.inlen ? POLLIN : 0;
+        ready += B.inlen != 0;
+    }
+    if (out < n) {                          // the captured terminal is always writable
+        fds[out].fd = STDOUT_FILENO;
+        fds[out].revents = fds[out].events & POLLOUT;
+        ready += fds[out].revents != 0;
+    }
+    return ready;
+}
+
+int benchIoctl(int fd, unsigned long req, void *arg) { // report the bench size
+    struct winsize *ws = arg;
+    benchCount();
+    (void)fd;
+    if (req != TIOCGWINSZ) return -1;
+    memset(ws, 0, sizeof(*ws));
+    ws->ws_row = B.rows;
+    ws->ws_col = B.cols;
+    return 0;
+}
+
+/*** Allocation Counting ***/
+/* Frames are built by editorRefreshScreen() on the main thread and sent by
+   the render thread. Once the editor is warmed up neither should touch the
+   heap, so allocations made on those two threads while benchFrame() draws
+   are counted, and a replay that makes any fails. */
+struct benchAlloc {
+    pthread_t main, render;                 // the threads that build frames
+    int counting;                           // benchFrame() is drawing
+    unsigned long calls;                    // malloc(), realloc() and calloc() calls meanwhile
+};
+
+struct benchAlloc A;
+
+void benchAllocCount(void) {                // count an allocation made for a frame
+    pthread_t self = pthread_self();
+    if (__atomic_load_n(&A.counting, __ATOMIC_RELAXED) &&
+        (pthread_equal(self, A.main) || pthread_equal(self, A.render)))
+        __atomic_fetch_add(&A.calls, 1, __ATOMIC_RELAXED);
+}
+
+void *benchMalloc(size_t len) {
+    benchAllocCount();
+    return malloc(len);
+}
+
+void *benchRealloc(void *p, size_t len) {
+    benchAllocCount();
+    return realloc(p, len);
+}
+
+void *benchCalloc(size_t n, size_t size) {
+    benchAllocCount();
+    return calloc(n, size);
+}
+
+#define read benchRead
+#define write benchWrite
+#define poll benchPoll
+#define ioctl(fd, req, arg) benchIoctl(fd, req, arg)
+#define malloc benchMalloc
+#define realloc benchRealloc
+#define calloc benchCalloc
+#define KILO_BENCH                          // the editor's main() is left out
+#include "kilo.c"
+#undef read
+#undef write
+#undef poll
+#undef ioctl
+#undef malloc
+#undef realloc
+#undef calloc
+
+/*** Virtual Terminal ***/
+/* Just enough of a VT100 to follow what the editor sends: cursor motion,
+   erases, scroll regions, SGR and UTF-8 text with a pending wrap at the
+   last column. It answers mode 2026 queries like a terminal that has
+   synchronized output. The result is checked against the editor's front
+   grid. */
+enum vtState { VT_GROUND, VT_ESC, VT_CSI };
+
+struct vt {
+    struct cell *cells;             // rows * cols, same layout as the grid
+    int rows, cols;
+    int y, x;                       // cursor
+    int wrap;                       // last column written, wrap on next char
+    int attr;                       // ATTR_* for new text
+    struct attrStyle style;         // SGR state behind attr
+    int top, bot;                   // scroll region, inclusive
+    struct cell *last;              // cell that UTF-8 continuation bytes extend
+    int state;                      // VT_* parser state
+    int params[16], numparams, priv, inter;
+    int sync;                       // inside a mode 2026 synchronized update
+    char reply[64];                 // answers to queries, not yet read by the editor
+    size_t replylen;
+    unsigned long unknown;          // sequences the emulator ignored
+    unsigned long long escbytes;    // escape sequences and control characters
+    unsigned long long textbytes;   // bytes that land in cells
+};
+
+struct vt V;
+
+void vtResize(int rows, int cols) {         // blank screen of the given size
+    int i;
+    free(V.cells);
+    V.cells = malloc(sizeof(struct cell) * rows * cols);
+    if (V.cells == NULL) abort();
+    for (i = 0; i < rows * cols; i++) cellSet(&V.cells[i], " ", 1, ATTR_NORMAL);
+    V.rows = rows;
+    V.cols = cols;
+    V.y = V.x = V.wrap = 0;
+    V.top = 0;
+    V.bot = rows - 1;
+    V.attr = ATTR_NORMAL;
+    memset(&V.style, 0, sizeof(V.style));
+    V.last = NULL;
+    V.state = VT_GROUND;
+}
+
+struct cell *vtRow(int y) { return V.cells + (size_t)y * V.cols; }
+
+void vtErase(int y, int from, int to) {     // blank part of a row
+    for (; from < to; from++) cellSet(&vtRow(y)[from], " ", 1, ATTR_NORMAL);
+}
+
+void vtScroll(int n) {                      // scroll the region, n < 0 scrolls down
+    int y;
+    for (; n > 0; n--) {
+        for (y = V.top; y < V.bot; y++) memcpy(vtRow(y), vtRow(y + 1), sizeof(struct cell) * V.cols);
+        vtErase(V.bot, 0, V.cols);
+    }
+    for (; n < 0; n++) {
+        for (y = V.bot; y > V.top; y--) memcpy(vtRow(y), vtRow(y - 1), sizeof(struct cell) * V.cols);
+        vtErase(V.top, 0, V.cols);
+    }
+    V.last = NULL;
+}
+
+void vtLineFeed(void) {
+    if (V.y == V.bot) vtScroll(1);
+    else if (V.y < V.rows - 1) V.y++;
+}
+
+int vtParam(int i, int def) {               // CSI parameter, 0 or missing means def
+    return i < V.numparams && V.params[i] ? V.params[i] : def;
+}
+
+int vtClamp(int v, int lo, int hi) { return v < lo ? lo : v > hi ? hi : v; }
+
+void vtReply(const char *fmt, int a, int b) { // queue an answer for the editor
+    int n = snprintf(V.reply + V.replylen, sizeof(V.reply) - V.replylen, fmt, a, b);
+    if (n > 0 && (size_t)n < sizeof(V.reply) - V.replylen) V.replylen += n;
+}
+
+void vtCsi(int final) {                     // run a complete CSI sequence
+    int n = vtParam(0, 1), i;
+    if (V.priv == '?' && V.inter == '$' && final == 'p') { // DECRQM
+        vtReply("\x1b[?%d;%d$y", vtParam(0, 0), vtParam(0, 0) == 2026 ? 2 : 0);
+        return;
+    }
+    if (V.priv || V.inter) {                // DEC private modes change no cells
+        if (final != 'h' && final != 'l') V.unknown++;
+        else if (vtParam(0, 0) == 2026) V.sync = final == 'h';
+        return;
+    }
+    switch (final) {
+        case 'H': case 'f':
+            V.y = vtClamp(vtParam(0, 1) - 1, 0, V.rows - 1);
+            V.x = vtClamp(vtParam(1, 1) - 1, 0, V.cols - 1);
+            break;
+        case 'A': V.y = vtClamp(V.y - n, 0, V.rows - 1); break;
+        case 'B': V.y = vtClamp(V.y + n, 0, V.rows - 1); break;
+        case 'C': V.x = vtClamp(V.x + n, 0, V.cols - 1); break;
+        case 'D': V.x = vtClamp(V.x - n, 0, V.cols - 1); break;
+        case 'G': V.x = vtClamp(n - 1, 0, V.cols - 1); break;
+        case 'K':
+            if (vtParam(0, 0) == 0) vtErase(V.y, V.x, V.cols);
+            else if (vtParam(0, 0) == 1) vtErase(V.y, 0, V.x + 1);
+            else vtErase(V.y, 0, V.cols);
+            break;
+        case 'J':
+            if (vtParam(0, 0) == 2) for (i = 0; i < V.rows; i++) vtErase(i, 0, V.cols);
+            else if (vtParam(0, 0) == 0) {
+                vtErase(V.y, V.x, V.cols);
+                for (i = V.y + 1; i < V.rows; i++) vtErase(i, 0, V.cols);
+            } else V.unknown++;
+            break;
+        case 'm':
+            if (V.numparams == 0) memset(&V.style, 0, sizeof(V.style));
+            for (i = 0; i < V.numparams; i++) {
+                int p = V.params[i];
+                if (p == 0) memset(&V.style, 0, sizeof(V.style));
+                else if (p == 1 || p == 22) V.style.bold = p == 1;
+                else if (p == 4 || p == 24) V.style.underline = p == 4;
+                else if (p == 7 || p == 27) V.style.inverse = p == 7;
+                else if ((p >= 30 && p <= 37) || (p >= 90 && p <= 97)) V.style.fg = p;
+                else if (p == 39) V.style.fg = 0;
+                else if ((p >= 40 && p <= 47) || (p >= 100 && p <= 107)) V.style.bg = p;
+                else if (p == 49) V.style.bg = 0;
+                else V.unknown++;
+            }
+            for (i = 0; i < (int)(sizeof(attrStyles) / sizeof(attrStyles[0])); i++)
+                if (memcmp(&attrStyles[i], &V.style, sizeof(V.style)) == 0) break;
+            if (i < (int)(sizeof(attrStyles) / sizeof(attrStyles[0]))) V.attr = i;
+            else V.unknown++;               // a style kilo has no attribute for
+            break;
+        case 'r':
+            V.top = vtClamp(vtParam(0, 1) - 1, 0, V.rows - 1);
+            V.bot = vtClamp(vtParam(1, V.rows) - 1, V.top, V.rows - 1);
+            V.y = V.x = 0;
+            break;
+        case 'S': vtScroll(n); break;
+        case 'T': vtScroll(-n); break;
+        case 'n':
+            if (vtParam(0, 0) == 6) vtReply("\x1b[%d;%dR", V.y + 1, V.x + 1);
+            break;
+        default: V.unknown++; break;
+    }
+    V.wrap = 0;
+}
+
+void vtFeed(const char *s, size_t len) {    // interpret terminal output
+    size_t i;
+    for (i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (V.state != VT_GROUND || c < 0x20) V.escbytes++;
+        else V.textbytes++;
+        if (V.state == VT_ESC) {
+            V.state = VT_GROUND;
+            if (c == '[') {
+                V.state = VT_CSI;
+                V.numparams = V.priv = V.inter = 0;
+                V.params[0] = 0;
+            } else {
+                V.unknown++;
+            }
+        } else if (V.state == VT_CSI) {
+            if (c >= '0' && c <= '9') {
+                if (V.numparams == 0) V.numparams = 1;
+                V.params[V.numparams - 1] = V.params[V.numparams - 1] * 10 + c - '0';
+            } else if (c == ';') {
+                if (V.numparams == 0) V.numparams = 1;
+                if (V.numparams < 16) V.params[V.numparams++] = 0;
+            } else if (c >= 0x3c && c <= 0x3f) {
+                V.priv = c;
+            } else if (c >= 0x20 && c <= 0x2f) {
+                V.inter = c;
+            } else if (c >= 0x40 && c <= 0x7e) {
+                V.state = VT_GROUND;
+                vtCsi(c);
+            }
+        } else if (c == '\x1b') {
+            V.state = VT_ESC;
+        } else if (c == '\r') {
+            V.x = V.wrap = 0;
+        } else if (c == '\n') {
+            V.wrap = 0;
+            vtLineFeed();
+        } else if (c == '\b') {
+            if (V.x > 0) V.x--;
+            V.wrap = 0;
+        } else if (c < 0x20) {
+            continue;                       // bell and friends
+        } else if (isUtf8Cont(c)) {
+            if (V.last && V.last->len < 4) V.last->ch[V.last->len++] = c;
+        } else {
+            if (V.wrap) {
+                V.x = V.wrap = 0;
+                vtLineFeed();
+            }
+            V.last = &vtRow(V.y)[V.x];
+            cellSet(V.last, (const char *)&c, 1, V.attr);
+            if (V.x == V.cols - 1) V.wrap = 1;
+            else V.x++;
+        }
+    }
+}
+
+int vtCheck(void) {                         // cells that differ from the front grid
+    struct screenGrid *g = &E.grid;
+    int i, bad = 0;
+    if (g->rows != V.rows || g->cols != V.cols || V.sync) return g->rows * g->cols;
+    for (i = 0; i < V.rows * V.cols; i++) bad += !cellEqual(&V.cells[i], &g->front[i]);
+    return bad;
+}
+
+/*** Key Scripts ***/
+struct script {                             // keystrokes, each delivered on its own
+    char *b;                                // all key bytes back to back
+    size_t len, cap;
+    size_t *ends;                           // ends[i]: offset just past key i
+    int numkeys, capkeys;
+};
+
+void scriptKey(struct script *s, const char *k, size_t len) { // append one keystroke
+    if (s->len + len > s->cap) {
+        s->cap = (s->len + len) * 2;
+        s->b = realloc(s->b, s->cap);
+    }
+    if (s->numkeys == s->capkeys) {
+        s->capkeys = s->capkeys ? s->capkeys * 2 : 256;
+        s->ends = realloc(s->ends, sizeof(size_t) * s->capkeys);
+    }
+    if (s->b == NULL || s->ends == NULL) abort();
+    memcpy(s->b + s->len, k, len);
+    s->len += len;
+    s->ends[s->numkeys++] = s->len;
+}
+
+void scriptRepeat(struct script *s, const char *k, int times) {
+    while (times-- > 0) scriptKey(s, k, strlen(k));
+}
+
+void scriptText(struct script *s, const char *text) { // one keystroke per character
+    while (*text) {
+        size_t n = 1;
+        while (isUtf8Cont((unsigned char)text[n])) n++;
+        scriptKey(s, text, n);
+        text += n;
+    }
+}
+
+size_t scriptKeyLen(const unsigned char *p, size_t len) { // bytes in the recorded key at p
+    size_t n = 1;
+    if (p[0] == '\x1b' && len > 1 && p[1] == '[') {
+        for (n = 2; n < len && (p[n] < 0x40 || p[n] > 0x7e); n++);
+        return n < len ? n + 1 : len;
+    }
+    if (p[0] == '\x1b' && len > 2 && p[1] == 'O') return 3;
+    if (p[0] >= 0xc0) while (n < len && isUtf8Cont(p[n])) n++;
+    return n;
+}
+
+int scriptLoad(struct script *s, const char *path) { // raw input bytes, split into keys
+    FILE *fp = fopen(path, "rb");
+    char *buf = NULL;
+    size_t len = 0, cap = 0, n, off;
+    if (fp == NULL) return -1;
+    do {
+        if (len == cap && (buf = realloc(buf, cap = cap ? cap * 2 : 65536)) == NULL) abort();
+        n = fread(buf + len, 1, cap - len, fp);
+        len += n;
+    } while (n > 0);
+    fclose(fp);
+    for (off = 0; off < len; ) {
+        size_t k = scriptKeyLen((unsigned char *)buf + off, len - off);
+        scriptKey(s, buf + off, k);
+        off += k;
+    }
+    free(buf);
+    return 0;
+}
+
+/*** Workloads ***/
+const char *benchWords[] = {
+    "static", "int", "return", "buffer", "size_t", "len", "for", "while",
+    "if", "else", "struct", "editor", "const", "char", "*p", "=", "+=",
+    "0;", "NULL", "free(p);", "café", "→", "{", "}", "// comment",
+};
+
+unsigned benchRand(void) {                  // deterministic LCG
+    static unsigned seed = 12345;
+    seed = seed * 1103515245 + 12345;
+    return seed >> 16;
+}
+
+void benchDocument(const char *path, int lines) { // synthetic source file
+    FILE *fp = fopen(path, "w");
+    int i, j, nwords = sizeof(benchWords) / sizeof(benchWords[0]);
+    if (fp == NULL) die("fopen");
+    for (i = 0; i < lines; i++) {
+        int depth = benchRand() % 4, words = benchRand() % 14;
+        if (benchRand() % 50 == 0) words = 60; // some lines run off the screen
+        if (i == 2) {                       // stray continuation bytes, see benchRowGuard()
+            fputc('x', fp);
+            for (j = 0; j < 600; j++) fputc(0x80, fp);
+        }
+        for (j = 0; j < depth; j++) fputc('\t', fp);
+        for (j = 0; j < words; j++) fprintf(fp, "%s%s", j ? " " : "", benchWords[benchRand() % nwords]);
+        fputc('\n', fp);
+    }
+    fclose(fp);
+}
+
+void benchLogDocument(const char *path, int lines) { // synthetic server log with a few rare lines
+    const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN"};
+    const char *routes[] = {"/api/items", "/api/users", "/api/cart", "/static/app.js", "/health"};
+    FILE *fp = fopen(path, "w");
+    int i;
+    if (fp == NULL) die("fopen");
+    for (i = 0; i < lines; i++) {
+        int s = i / 30 % 86400;
+        fprintf(fp, "2026-10-16T%02d:%02d:%02d.%03dZ ", s / 3600, s / 60 % 60, s % 60, i % 1000);
+        if (i % 400000 == 123456)
+            fprintf(fp, "ERROR disk quota exceeded on /var/lib/db%d\n", i % 7);
+        else if (i % 700000 == 654321)
+            fprintf(fp, "WARN  payment timeout order=%u\n", benchRand());
+        else
+            fprintf(fp, "%-5s req=%04x%04x GET %s/%u 200 %ums\n", levels[benchRand() % 5], benchRand(),
+                    benchRand(), routes[benchRand() % 5], benchRand() % 10000, benchRand() % 500);
+    }
+    fclose(fp);
+}
+
+void wlTyping(struct script *s) {           // prose with newlines and corrections
+    const char *text = "The quick brown fox jumps over the lazy dog; naïve café owners ";
+    int i;
+    scriptRepeat(s, "\x1b[6~", 3);
+    for (i = 0; i < 60; i++) {
+        scriptText(s, text);
+        if (i % 4 == 3) scriptRepeat(s, "\x7f", 5);
+        if (i % 2 == 1) scriptKey(s, "\r", 1);
+        if (i % 10 == 5) {                  // keys and replies the editor drops
+            scriptKey(s, "\x1b[15~", 5);    // F5
+            scriptKey(s, "\x1b[I", 3);      // focus in
+            scriptKey(s, "\x1b[<0;10;5M", 10); // mouse press
+        }
+    }
+}
+
+void wlScrolling(struct script *s) {        // line by line past the screen edge
+    scriptRepeat(s, "\x1b[B", 3000);
+    scriptRepeat(s, "\x1b[A", 1500);
+    scriptRepeat(s, "\x1b[C", 200);         // drag the view sideways on long lines
+    scriptRepeat(s, "\x1b[B", 500);
+}
+
+void wlPaging(struct script *s) {           // whole screens at a time
+    int i;
+    for (i = 0; i < 400; i++) {
+        scriptKey(s, "\x1b[6~", 4);
+        if (i % 10 == 9) scriptRepeat(s, i % 20 == 9 ? "\x1b[F" : "\x1b[H", 1);
+    }
+    scriptRepeat(s, "\x1b[5~", 200);
+}
+
+void wlSearch(struct script *s) {          // Ctrl-F queries typed, stepped through, left
+    const char *queries[] = {"free(p);", "café", "struct editor", "no such text"};
+    int i, j;
+    for (i = 0; i < 40; i++) {
+        scriptKey(s, "\x06", 1);
+        scriptText(s, queries[i % 4]);
+        for (j = 0; j < 10; j++) scriptKey(s, j % 3 == 2 ? "\x1b[A" : "\x1b[B", 3);
+        scriptRepeat(s, "\x7f", 2);
+        scriptKey(s, i % 2 ? "\r" : "\x1b", 1);
+    }
+    for (i = 0; i < 10; i++) {              // the same through the regex engine
+        scriptKey(s, "\x06\x12", 2);
+        scriptText(s, i % 2 ? "st[a-z]+ ed.*r" : "^ +free\\(");
+        for (j = 0; j < 10; j++) scriptKey(s, "\x1b[B", 3);
+        scriptKey(s, "\x1b", 1);
+    }
+}
+
+struct workload {
+    const char *name;
+    void (*build)(struct script *s);
+};
+
+struct workload benchWorkloads[] = {
+    {"typing", wlTyping},
+    {"scrolling", wlScrolling},
+    {"paging", wlPaging},
+    {"search", wlSearch},
+};
+
+/*** Runner ***/
+long long benchNow(void) {                  // monotonic clock in nanoseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int benchCmp(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+void benchHighlight(int all) {              // main()'s wait for visible rows, without a time limit
+    editorScroll();
+    while (hlSchedule(E.rowoff, E.rowoff + E.screenrows) > 0 || (all && !hlIdle())) {
+        while (hlQueuePeek(&E.hl.done) == NULL) sched_yield();
+        hlCollect(E.rowoff, E.rowoff + E.screenrows);
+    }
+}
+
+void benchFrame(void) {                     // main()'s redraw without the frame cap
+    if (E.dirty) benchHighlight(0);
+    __atomic_store_n(&A.counting, 1, __ATOMIC_RELAXED);
+    if (E.dirty && editorRefreshScreen()) E.dirty = 0;
+    renderSync();                           // until the render thread has written it
+    __atomic_store_n(&A.counting, 0, __ATOMIC_RELAXED);
+}
+
+void benchAnswer(void) {                    // let the editor read the VT's replies
+    while (V.replylen) {
+        char reply[sizeof(V.reply)];
+        memcpy(reply, V.reply, V.replylen);
+        B.in = reply;
+        B.inlen = V.replylen;
+        V.replylen = 0;
+        editorInputEvent(STDIN_FILENO);
+        benchFrame();
+        vtFeed(B.out, B.outlen);
+        B.outlen = 0;
+    }
+}
+
+void benchOpen(const char *path) {          // fresh document and a blank terminal
+    editorOpen(path);
+    while (docLineCount() == DOC_UNKNOWN) liWait(&E.pt.idx, liIndexed(&E.pt.idx));
+    drainPipe(E.workerpipe[0]);
+    E.cx = E.cy = E.rx = E.rowoff = E.coloff = 0;
+    benchHighlight(1);                      // the whole file, so keys only pay for their edits
+    drainPipe(E.hl.notify[0]);
+    E.grid.valid = 0;
+    E.dirty = 1;
+    vtResize(B.rows, B.cols);
+    benchFrame();
+    vtFeed(B.out, B.outlen);
+    B.outlen = 0;
+    benchAnswer();
+}
+
+int benchRowGuard(size_t line) {            // render a line into exactly one screen row
+    struct cell *row = malloc(sizeof(struct cell) * (E.screencols + 1)), guard;
+    int used, bad, i;
+    if (row == NULL) abort();
+    cellSet(&guard, "#", 1, ATTR_NORMAL);
+    row[E.screencols] = guard;              // one cell past the row must survive
+    used = editorRenderRow(docLineStart(line), NULL, 0, row);
+    bad = used > E.screencols || !cellEqual(&row[E.screencols], &guard);
+    for (i = 0; i < used && !bad; i++) bad = row[i].len > sizeof(row[i].ch);
+    if (bad) fprintf(stderr, "line %zu: rendered past the end of its row\n", line + 1);
+    free(row);
+    return bad;
+}
+
+#define BENCH_KEY_TIMEOUT 10                // seconds one key may take before the replay is stuck
+
+struct benchWatch {                         // what the replay is doing, for the watchdog
+    const char *name;                       // workload
+    int key;                                // keystroke being handled
+};
+
+struct benchWatch W;
+
+void benchWatchdog(int sig) {               // SIGALRM: a key never finished, say which and fail
+    char num[16];
+    int n = sizeof(num);
+    unsigned k = W.key + 1;
+    (void)sig;
+    do num[--n] = '0' + k % 10; while ((k /= 10) && n > 0);
+    write(STDERR_FILENO, W.name, strlen(W.name));
+    write(STDERR_FILENO, ": key ", 6);
+    write(STDERR_FILENO, num + n, sizeof(num) - n);
+    write(STDERR_FILENO, " made no progress, giving up\n", 29);
+    _exit(1);
+}
+
+int benchRun(const char *name, const char *path, struct script *s) { // replay, print one line
+    long long *ns = malloc(sizeof(long long) * (s->numkeys ? s->numkeys : 1));
+    unsigned long long bytes = 0;
+    unsigned long calls = 0;
+    int i, bad, stuck = 0;
+    if (ns == NULL) abort();
+
+    W.name = name;
+    W.key = -1;
+    signal(SIGALRM, benchWatchdog);
+    alarm(BENCH_KEY_TIMEOUT);
+    benchOpen(path);
+    unsigned long lexed = E.hl.lexed;       // lines the highlighter lexed for the first frame
+    unsigned long allocs = A.calls;         // the first frame may size the buffers
+    V.escbytes = V.textbytes = 0;
+    for (i = 0; i < s->numkeys; i++) {
+        size_t start = i ? s->ends[i - 1] : 0;
+        B.in = s->b + start;
+        B.inlen = s->ends[i] - start;
+        W.key = i;
+        alarm(BENCH_KEY_TIMEOUT);           // outside the timed part
+        unsigned long c0 = __atomic_load_n(&B.syscalls, __ATOMIC_RELAXED);
+        long long t0 = benchNow();
+        editorInputEvent(STDIN_FILENO);
+        if (E.in.state != IS_GROUND) editorInputTimeout(); // the pause before the next key; a paste runs on
+        benchFrame();
+        ns[i] = benchNow() - t0;
+        if (B.inlen && stuck++ == 0)        // the editor must take every byte it was woken for
+            fprintf(stderr, "%s: key %d left %zu bytes unread\n", name, i + 1, B.inlen);
+        calls += __atomic_load_n(&B.syscalls, __ATOMIC_RELAXED) - c0;
+        bytes += B.outlen;
+        vtFeed(B.out, B.outlen);            // outside the timed part
+        B.outlen = 0;
+        benchAnswer();
+    }
+    alarm(0);
+    bad = vtCheck();
+
+    qsort(ns, s->numkeys, sizeof(long long), benchCmp);
+    int n = s->numkeys ? s->numkeys : 1;
+    printf("%-10s %6d  %8.1f  %8.1f  %9.1f  %8.2f  %8.2f  %8.2f  %s\n", name, s->numkeys,
+           ns[(n - 1) / 2] / 1e3, ns[(n - 1) * 99 / 100] / 1e3, (double)bytes / n,
+           (double)V.escbytes / (V.textbytes ? V.textbytes : 1), (double)calls / n,
+           (double)(E.hl.lexed - lexed) / n, bad ? "MISMATCH" : "ok");
+    if (bad) fprintf(stderr, "%s: %d cells differ from the editor's grid\n", name, bad);
+    if ((allocs = A.calls - allocs)) fprintf(stderr, "%s: %lu heap allocations while drawing frames\n", name, allocs);
+    free(ns);
+    return bad != 0 || allocs != 0 || stuck != 0;
+}
+
+void benchLongLine(size_t mb) {              // type into the middle of one huge line
+    const char json[] = "{\"key\":[1,2,3],\"value\":\"text\"},";
+    const int keys = 10000;
+    size_t len = mb << 20, i, cx;
+    char *line = malloc(len);
+    int j;
+    if (line == NULL) abort();
+    for (i = 0; i < len; i++) line[i] = json[i % (sizeof(json) - 1)];
+    printf("\ntyping %d characters into the middle of a %zu MB line\n", keys, mb);
+    printf("%-8s %10s %10s\n", "backend", "total ms", "ns/key");
+    for (i = 0; i < sizeof(docBackends) / sizeof(docBackends[0]); i++) {
+        editorClose();
+        E.docops = &docBackends[i];
+        docInit(line, len, -1);
+        long long t0 = benchNow();
+        for (j = 0, cx = len / 2; j < keys; j++, cx++) docInsert(docLineStart(0) + cx, "a", 1);
+        long long t = benchNow() - t0;
+        printf("%-8s %10.1f %10.1f\n", E.docops->name, t / 1e6, (double)t / keys);
+    }
+    editorClose();
+    free(line);
+}
+
+void benchPaste(size_t mb) {                // one bracketed paste of a big log excerpt
+    size_t cap = (mb << 20) + 64, len = 6, lines = 0, i;
+    char *in = malloc(cap);
+    if (in == NULL) abort();
+    memcpy(in, "\x1b[200~", 6);
+    while (len + 6 < (mb << 20)) {          // terminals send line breaks as CR
+        len += snprintf(in + len, cap - len, "2024-05-01 12:%02zu:%02zu INFO worker[%zu]: "
+                        "request %zu served in %u ms\r", lines / 60 % 60, lines % 60,
+                        lines % 16, lines, benchRand() % 500);
+        lines++;
+    }
+    memcpy(in + len, "\x1b[201~", 6);
+    len += 6;
+    printf("\npasting a %zu MB log excerpt (%zu lines)\n", mb, lines);
+    printf("%-8s %10s %10s\n", "backend", "total ms", "MB/s");
+    for (i = 0; i < sizeof(docBackends) / sizeof(docBackends[0]); i++) {
+        editorClose();
+        E.docops = &docBackends[i];
+        docInit(NULL, 0, -1);
+        E.cx = E.cy = 0;
+        B.in = in;
+        B.inlen = len;
+        long long t0 = benchNow();
+        editorInputEvent(STDIN_FILENO);
+        long long t = benchNow() - t0;
+        if (docLength() != len - 12 || E.cy != lines) fprintf(stderr, "%s: paste lost text\n", E.docops->name);
+        printf("%-8s %10.1f %10.1f\n", E.docops->name, t / 1e6, (len - 12) / 1048576.0 / (t / 1e9));
+    }
+    editorClose();
+    free(in);
+}
+
+volatile size_t benchSink;
+
+void benchModels(const char *path) {        // every backend on the same big file
+    const int lookups = 100000, inserts = 10000, edits = 200;
+    size_t i;
+    printf("kilo-bench: document models on %s\n", path);
+    printf("%-8s %10s %10s %10s %10s %12s %10s\n", "backend", "lines", "load ms",
+           "lookup ns", "iter ms", "insert ns", "edit+look us");
+    for (i = 0; i < sizeof(docBackends) / sizeof(docBackends[0]); i++) {
+        size_t lines, n, pos, nl = 0;
+        const char *p;
+        int j;
+        editorClose();
+        E.docops = &docBackends[i];
+        docInit(NULL, 0, -1);
+
+        long long t0 = benchNow();          // load: open until every line is known
+        editorOpen(path);
+        while ((lines = docLineCount()) == DOC_UNKNOWN) liWait(&E.pt.idx, liIndexed(&E.pt.idx));
+        double load = (benchNow() - t0) / 1e6;
+
+        t0 = benchNow();                    // jump to random lines
+        for (j = 0; j < lookups; j++) nl += docLineStart(benchRand() * 7919ULL % lines);
+        double lookup = (double)(benchNow() - t0) / lookups;
+
+        t0 = benchNow();                    // walk the whole text as the renderer would
+        for (pos = 0; (p = docSpan(pos, &n)) != NULL; pos += n) nl += countNewlines(p, n);
+        double iter = (benchNow() - t0) / 1e6;
+
+        t0 = benchNow();                    // type into the middle line
+        for (j = 0; j < inserts; j++)
+            docInsert(docLineStart(lines / 2) + j % 40, j % 20 == 19 ? "\n" : "x", 1);
+        double insert = (double)(benchNow() - t0) / inserts;
+
+        t0 = benchNow();                    // edit, then look up a line further down
+        for (j = 0; j < edits; j++) {
+            docInsert(docLineStart(lines / 2), "y", 1);
+            nl += docLineStart(lines / 2 + benchRand() * 7919ULL % (lines / 2));
+        }
+        double editlook = (benchNow() - t0) / 1e3 / edits;
+
+        benchSink += nl;                    // keep the lookups from being optimized out
+        printf("%-8s %10zu %10.1f %10.1f %10.1f %10.1f %12.1f\n", E.docops->name, lines,
+               load, lookup, iter, insert, editlook);
+    }
+    benchLongLine(10);
+    benchPaste(50);
+}
+
+void benchDecodeStream(const char *name, const struct script *s) { // a byte stream through the decoder, over and over
+    const size_t total = 64 << 20;
+    unsigned long long keys = 0, reads = 0;
+    size_t done;
+    long long t0 = benchNow();
+    for (done = 0; done < total; done += s->len) {
+        B.in = s->b;
+        B.inlen = s->len;
+        while (1) {                         // editorInputEvent() without the editor
+            if (inputDecode() != KEY_PENDING) keys++;
+            else if (inputFill(0)) reads++;
+            else break;
+        }
+        if (inputPartial()) inputFlush(), keys++; // editorInputTimeout()
+    }
+    double secs = (benchNow() - t0) / 1e9;
+    printf("%-10s %10zu %10llu %12.1f %10.1f %12.1f\n", name, s->len, keys * s->len / done,
+           keys / secs / 1e6, done / secs / (1 << 20), (double)done / reads);
+}
+
+void benchDecode(const char *recording) { // keys decoded per second from recorded or scripted input
+    const char *mods[] = {"\x1b[1;5C", "\x1b[1;2A", "\x1b[1;3D", "\x1b[3;5~", "\x1b[6;2~", "\x1bOH",
+                          "\x1bOF", "\x1bOA", "\x1bx", "\x1b[5~", "\x1b[7~", "\x1b[1;6B"};
+    struct script s = {0};
+    int i;
+    printf("kilo-bench: input decoding, %d-byte reads\n", INPUT_BUFSIZE);
+    printf("%-10s %10s %10s %12s %10s %12s\n", "stream", "bytes", "keys", "Mkeys/s", "MB/s", "bytes/read");
+    if (recording) {
+        if (scriptLoad(&s, recording) == -1) die(recording);
+        benchDecodeStream("recording", &s);
+        return;
+    }
+    for (i = 0; i < (int)(sizeof(benchWorkloads) / sizeof(benchWorkloads[0])); i++) {
+        benchWorkloads[i].build(&s);
+        benchDecodeStream(benchWorkloads[i].name, &s);
+        s.len = s.numkeys = 0;
+    }
+    while (s.len < 100000) {                // an unbracketed paste: text, tabs and UTF-8
+        scriptText(&s, benchWords[benchRand() % (sizeof(benchWords) / sizeof(benchWords[0]))]);
+        scriptText(&s, benchRand() % 8 ? " " : benchRand() % 2 ? "\r\t" : "\r");
+    }
+    benchDecodeStream("paste", &s);
+    s.len = s.numkeys = 0;
+    for (i = 0; i < 20000; i++) {           // modified arrows, function keys, SS3 and Alt
+        const char *k = mods[benchRand() % (sizeof(mods) / sizeof(mods[0]))];
+        scriptKey(&s, k, strlen(k));
+    }
+    benchDecodeStream("modifiers", &s);
+    free(s.b);
+    free(s.ends);
+}
+
+unsigned long benchHash(void) {             // FNV-1a of the whole document
+    unsigned long h = 2166136261u;
+    size_t pos, n, k;
+    const char *p;
+    for (pos = 0; (p = docSpan(pos, &n)) != NULL; pos += n)
+        for (k = 0; k < n; k++) h = (h ^ (unsigned char)p[k]) * 16777619u;
+    return h;
+}
+
+void benchEdits(const char *path, long ops) { // random inserts and deletes, every backend
+    long long *t = malloc(sizeof(long long) * ops);
+    unsigned long first = 0;
+    size_t i;
+    if (t == NULL) die("malloc");
+    printf("kilo-bench: %ld random edits on %s\n", ops, path);
+    printf("%-8s %10s %10s %10s %10s %10s %12s\n", "backend", "bytes", "mean ns",
+           "p50 ns", "p99 ns", "max us", "final bytes");
+    for (i = 0; i < sizeof(docBackends) / sizeof(docBackends[0]); i++) {
+        unsigned seed = 4242;               // same edits for every backend
+        size_t len, start;
+        long j;
+        editorClose();
+        E.docops = &docBackends[i];
+        docInit(NULL, 0, -1);
+        editorOpen(path);
+        while (docLineCount() == DOC_UNKNOWN) liWait(&E.pt.idx, liIndexed(&E.pt.idx));
+        start = len = docLength();
+
+        long long total = benchNow();
+        for (j = 0; j < ops; j++) {
+            size_t r, pos, n;
+            seed = seed * 1103515245 + 12345;
+            r = seed >> 8;
+            n = 1 + (r & 15);
+            pos = len ? ((size_t)r >> 5) * 2654435761u % (len + 1) : 0;
+            long long t0 = benchNow();
+            if ((r & 16) || len < 4096) {   // half inserts, so the size holds steady
+                docInsert(pos, "kilo-bench edit\n" + 16 - n, n);
+                len += n;
+            } else {
+                if (n > len - pos) n = len - pos;
+                docDelete(pos, n);
+                len -= n;
+            }
+            t[j] = benchNow() - t0;
+        }
+        total = benchNow() - total;
+
+        unsigned long h = benchHash();
+        if (docLength() != len) fprintf(stderr, "%s: length %zu, expected %zu\n", E.docops->name, docLength(), len);
+        if (i == 0) first = h;
+        else if (h != first) fprintf(stderr, "%s: text differs from %s\n", E.docops->name, docBackends[0].name);
+        qsort(t, ops, sizeof(t[0]), benchCmp);
+        printf("%-8s %10zu %10.1f %10lld %10lld %10.1f %12zu\n", E.docops->name, start,
+               (double)total / ops, t[ops / 2], t[ops * 99 / 100], t[ops - 1] / 1e3, len);
+    }
+    editorClose();
+    free(t);
+}
+
+void benchBigDocument(const char *path, size_t gb) { // copies of a 1 MB block, then out of the page cache
+    char block[] = "/tmp/kilo-bench-block-XXXXXX";
+    FILE *fp;
+    char *b;
+    size_t len, done;
+    int fd = mkstemp(block);
+    if (fd == -1) die("mkstemp");
+    close(fd);
+    benchDocument(block, 25000);            // about 1 MB of source lines
+    if ((fp = fopen(block, "rb")) == NULL) die("fopen");
+    if ((b = malloc(2 << 20)) == NULL) die("malloc");
+    len = fread(b, 1, 2 << 20, fp);
+    fclose(fp);
+    unlink(block);
+    if ((fp = fopen(path, "wb")) == NULL) die("fopen");
+    for (done = 0; done < gb << 30; done += len)
+        if (fwrite(b, 1, len, fp) != len) die("fwrite");
+    if (fflush(fp) == EOF || fdatasync(fileno(fp)) == -1) die("fdatasync");
+    posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_DONTNEED); // the open starts cold
+    fclose(fp);
+    free(b);
+}
+
+void benchResident(double *rss, double *anon) { // current MB, -1 where /proc/self/statm is missing
+    long size, res, shared;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    *rss = *anon = -1;
+    if (fp == NULL) return;
+    if (fscanf(fp, "%ld %ld %ld", &size, &res, &shared) == 3) {
+        *rss = (double)res * sysconf(_SC_PAGESIZE) / (1 << 20);
+        *anon = (double)(res - shared) * sysconf(_SC_PAGESIZE) / (1 << 20);
+    }
+    fclose(fp);
+}
+
+void benchLoad(int gb) {                    // time to the first frame of 1 GB and 10 GB files
+    int sizes[] = {1, 10}, i, n = gb ? 1 : 2;
+    char tmp[] = "/tmp/kilo-bench-XXXXXX.c";
+    printf("kilo-bench: %s backend, cold open to first frame\n", E.docops->name);
+    printf("%8s %10s %10s %10s %10s %10s %10s %10s\n", "size GB", "write s", "frame ms",
+           "rss MB", "anon MB", "index ms", "rss MB", "peak MB");
+    for (i = 0; i < n; i++) {
+        int size = gb ? gb : sizes[i], fd = mkstemps(tmp, 2);
+        double rss, anon, rss2, anon2;
+        struct rusage ru;
+        if (fd == -1) die("mkstemps");
+        close(fd);
+        long long t0 = benchNow();
+        benchBigDocument(tmp, size);
+        double written = (benchNow() - t0) / 1e9;
+
+        t0 = benchNow();                    // main(): open, then the first frame
+        editorOpen(tmp);
+        E.cx = E.cy = E.rx = E.rowoff = E.coloff = 0;
+        E.grid.valid = 0;
+        E.dirty = 1;
+        benchFrame();
+        double frame = (benchNow() - t0) / 1e6;
+        B.outlen = 0;
+        benchResident(&rss, &anon);
+
+        while (docLineCount() == DOC_UNKNOWN) liWait(&E.pt.idx, liIndexed(&E.pt.idx));
+        double index = (benchNow() - t0) / 1e6;
+        benchResident(&rss2, &anon2);
+        getrusage(RUSAGE_SELF, &ru);
+        printf("%8d %10.1f %10.1f %10.1f %10.1f %10.0f %10.1f %10.1f\n", size, written, frame,
+               rss, anon, index, rss2, ru.ru_maxrss / 1024.0); // ru_maxrss is in KB on Linux
+        fflush(stdout);
+        editorClose();
+        unlink(tmp);
+        memcpy(tmp + strlen(tmp) - 8, "XXXXXX", 6); // mkstemps() wants the template back
+    }
+}
+
+size_t benchNlMemchr(const char *p, size_t len) { // the plain memchr() loop the kernels replace
+    const char *end = p + len;
+    size_t n = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) n++, p++;
+    return n;
+}
+
+size_t benchNlBytes(const char *p, size_t len) { // one byte at a time
+    size_t n = 0;
+    while (len--) n += *p++ == '\n';
+    return n;
+}
+
+void benchNewlines(const char *path) {      // newline counting throughput of every kernel
+    const size_t size = 256 << 20;          // well past the caches
+    struct {
+        const char *name;
+        const char *(*scan)(const char *, size_t, size_t, size_t *);
+        size_t (*count)(const char *, size_t);
+        int ok;
+    } k[] = {
+#ifdef KILO_SIMD_X86
+        {"avx2", nlScanAVX2, NULL, __builtin_cpu_supports("avx2")},
+        {"sse2", nlScanSSE2, NULL, __builtin_cpu_supports("sse2")},
+#endif
+        {"scalar", nlScanScalar, NULL, 1},
+        {"memchr", NULL, benchNlMemchr, 1},
+        {"bytes", NULL, benchNlBytes, 1},
+    };
+    char *text = malloc(size), *sparse = malloc(size);
+    FILE *fp = fopen(path, "rb");
+    size_t len = 0, i, j, nl = 0;
+    if (text == NULL || sparse == NULL || fp == NULL) die("benchNewlines");
+    while (len < size) {                    // the file over and over
+        size_t n = fread(text + len, 1, size - len, fp);
+        if (n == 0 && (len == 0 || fseek(fp, 0, SEEK_SET) == -1)) die("fread");
+        len += n;
+    }
+    fclose(fp);
+    for (i = 0; i < size; i++)              // the same text with lines 64 times as long
+        sparse[i] = text[i] == '\n' && nl++ % 64 ? ' ' : text[i];
+
+    printf("kilo-bench: newline counting on %s, repeated to %zu MB\n", path, size >> 20);
+    printf("%-8s %12s %12s\n", "kernel", "short GB/s", "long GB/s");
+    size_t expect[2] = {0, 0};
+    for (i = 0; i < sizeof(k) / sizeof(k[0]); i++) {
+        double gbs[2];
+        if (!k[i].ok) continue;
+        for (j = 0; j < 2; j++) {
+            const char *p = j ? sparse : text;
+            long long best = 0;
+            int r;
+            for (r = 0; r < 3; r++) {       // best of three
+                size_t n;
+                long long t0 = benchNow();
+                if (k[i].scan) k[i].scan(p, size, SIZE_MAX, &n);
+                else n = k[i].count(p, size);
+                t0 = benchNow() - t0;
+                if (best == 0 || t0 < best) best = t0;
+                if (expect[j] == 0) expect[j] = n;
+                else if (n != expect[j]) fprintf(stderr, "%s: %zu newlines, expected %zu\n", k[i].name, n, expect[j]);
+            }
+            gbs[j] = size / (double)best;
+        }
+        printf("%-8s %12.2f %12.2f%s\n", k[i].name, gbs[0], gbs[1], k[i].scan == nlScan ? "  (in use)" : "");
+    }
+    free(text);
+    free(sparse);
+}
+
+const char *benchMemmem(const char *p, size_t len, const char *s, size_t n) { return memmem(p, len, s, n); }
+
+const char *benchStrstr(const char *p, size_t len, const char *s, size_t n) { // text and needle end in NUL
+    (void)len;
+    (void)n;
+    return strstr(p, s);
+}
+
+struct searcher {
+    const char *name;
+    const char *(*find)(const char *p, size_t len, const char *s, size_t n);
+};
+
+struct searcher benchSearchers[] = {
+    {"scalar", findScalar},
+#ifdef KILO_SIMD_X86
+    {"sse2", findSSE2},
+    {"avx2", findAVX2},
+#endif
+    {"memmem", benchMemmem},
+    {"strstr", benchStrstr},
+};
+
+void benchFind(const char *path) {          // substring search throughput on one file
+    char rare[17] = "", word[17] = "", *absent = "kilo_bench_absent";
+    const char *needles[3] = {rare, word, absent};
+    size_t len, i, j, n, mid;
+    int fd = open(path, O_RDONLY), r;
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) die(path);
+    char *text = malloc(st.st_size + 1);    // NUL-terminated for strstr
+    if (text == NULL) abort();
+    for (len = 0; len < (size_t)st.st_size; len += n)
+        if ((n = read(fd, text + len, st.st_size - len)) <= 0) die("read");
+    text[len] = '\0';
+    close(fd);
+
+    mid = len / 2;                          // needles from the middle of the file
+    while (mid < len && text[mid] != '\n') mid++;
+    for (i = mid + 1; i < len && text[i] != '\n'; i++) if (text[i] != ' ' && text[i] != '\t') break;
+    for (j = 0; j < 16 && i + j < len && text[i + j] != '\n' && text[i + j] != '\0'; j++) rare[j] = text[i + j];
+    for (j = 0; j < 16 && rare[j] && rare[j] != ' '; j++) word[j] = rare[j];
+
+    editorOpen(path);                       // the same text as a document
+    printf("kilo-bench: substring search in %s, %.1f MB, GB/s counting every match\n",
+           path, len / 1048576.0);
+    printf("%-18s %8s", "needle", "matches");
+    for (i = 0; i < sizeof(benchSearchers) / sizeof(benchSearchers[0]); i++)
+        printf(" %8s", benchSearchers[i].name);
+    printf(" %8s\n", "document");
+    for (j = 0; j < 3; j++) {
+        const char *s = needles[j];
+        size_t sl = strlen(s), count = 0, c;
+        if (sl == 0) continue;
+        printf("\"%-16.16s\"", s);
+        double gbs[sizeof(benchSearchers) / sizeof(benchSearchers[0]) + 1];
+        int bad = 0;
+        for (i = 0; i <= sizeof(benchSearchers) / sizeof(benchSearchers[0]); i++) {
+            long long best = 0;
+            for (r = 0; r < 3; r++) {       // best of three
+                const char *p = text, *hit;
+                size_t at = 0;
+                long long t0 = benchNow();
+                c = 0;
+                if (i < sizeof(benchSearchers) / sizeof(benchSearchers[0])) {
+                    while ((hit = benchSearchers[i].find(p, text + len - p, s, sl)) != NULL) {
+                        c++;
+                        p = hit + 1;
+                    }
+                } else {                    // docFind() over the backend's spans
+                    while ((at = docFind(NULL, s, sl, at, len)) != FIND_NONE) {
+                        c++;
+                        at++;
+                    }
+                }
+                long long t = benchNow() - t0;
+                if (r == 0 || t < best) best = t;
+            }
+            if (i == 0) count = c;
+            bad |= c != count;
+            gbs[i] = len / (best / 1e9) / 1e9;
+        }
+        printf(" %8zu", count);
+        for (i = 0; i <= sizeof(benchSearchers) / sizeof(benchSearchers[0]); i++) printf(" %8.2f", gbs[i]);
+        printf("%s\n", bad ? "  MISMATCH" : "");
+    }
+
+    const char *patterns[] = {word, "[A-Z][a-z]+[0-9]+", "^ *(INSERT|COPY) ", "(x+x+)+y", "(a|b)*a(a|b){20}"};
+    printf("%-18s %8s %8s %8s\n", "regex", "matches", "MB/s", "flushes");
+    for (j = 0; j < sizeof(patterns) / sizeof(patterns[0]); j++) {
+        struct regex *re = reNew(patterns[j], strlen(patterns[j]));
+        size_t count = 0, at = 0, end;
+        int flushes = 0;
+        if (re == NULL) continue;
+        long long t0 = benchNow();
+        while ((at = docRegexFind(NULL, re, at, len, &end)) != FIND_NONE) {
+            count++;
+            flushes += re->dfa[RE_FORWARD].flushes;
+            at = end > at ? end : at + 1;
+        }
+        long long t = benchNow() - t0;
+        flushes += re->dfa[RE_FORWARD].flushes;
+        printf("%-18.18s %8zu %8.1f %8d\n", patterns[j], count, len / (t / 1e9) / 1048576.0, flushes);
+        reFree(re);
+    }
+    editorClose();
+    free(text);
+}
+
+void benchScaling(const char *path) {       // whole-document match counts on 1 to 32 threads
+    const int threads[] = {1, 2, 4, 8, 16, 32};
+    const char *queries[] = {"static", "kilo_bench_absent", "[A-Z][a-z]+[0-9]+", "^ *(INSERT|COPY) "};
+    const int nq = sizeof(queries) / sizeof(queries[0]);
+    size_t counts[sizeof(queries) / sizeof(queries[0])];
+    double base[sizeof(queries) / sizeof(queries[0])];
+    int i, q, r, complete, bad = 0;
+
+    editorOpen(path);
+    size_t len = docLength();
+    printf("kilo-bench: counting matches in %s, %.1f MB, %ld CPUs, GB/s and speedup\n",
+           path, len / 1048576.0, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-8s", "threads");
+    for (q = 0; q < nq; q++) printf(" %17.17s", queries[q]);
+    printf("\n");
+    for (i = 0; i < (int)(sizeof(threads) / sizeof(threads[0])); i++) {
+        searchStop();
+        searchStart(threads[i], -1);
+        printf("%-8d", SP.numthreads);
+        for (q = 0; q < nq; q++) {
+            int regex = q >= 2;             // the last two through the regex engine
+            long long best = 0;
+            size_t n = 0;
+            for (r = 0; r < 3; r++) {       // best of three
+                long long t0 = benchNow();
+                searchSubmit(SEARCH_COUNT, queries[q], strlen(queries[q]), regex, 0, 0, len);
+                n = searchCounted(1, &complete);
+                long long t = benchNow() - t0;
+                if (r == 0 || t < best) best = t;
+            }
+            double gbs = len / (best / 1e9) / 1e9;
+            if (i == 0) {
+                counts[q] = n;
+                base[q] = gbs;
+            }
+            bad |= n != counts[q];
+            printf(" %9.2f %6.2fx", gbs, gbs / base[q]);
+        }
+        printf("\n");
+    }
+    printf("%-8s", "matches");
+    for (q = 0; q < nq; q++) printf(" %17zu", counts[q]);
+    printf("%s\n", bad ? "  MISMATCH" : "");
+    searchStop();
+    editorClose();
+}
+
+void benchIncrementalKey(int key, const char *label) { // one prompt key, timed, then a pause for the count
+    int complete;
+    long long t0 = benchNow();
+    editorFindKey(key);
+    long long t = benchNow() - t0;
+    const char *how = E.find.set ? "narrowed" : E.find.len ? "searched" : "";
+    size_t n = E.find.set ? E.find.set->matches : searchCounted(1, &complete);
+    editorFindCollect();                    // what the event loop does when the count is in
+    printf("%-10s \"%-20.*s\" %9.3f %9zu  %s\n", label, (int)E.find.len, E.find.query, t / 1e6,
+           E.find.len ? n : 0, how);
+}
+
+void benchIncremental(const char *path) {   // a query typed a byte at a time, then taken back
+    char query[21] = "";
+    size_t i, pos;
+    editorOpen(path);
+    pos = docLineEnd(docLength() / 2) + 1;  // a line from the middle, without its indent
+    while (editorByteAt(pos) == '\t' || editorByteAt(pos) == ' ') pos++;
+    for (i = 0; i < 20 && editorByteAt(pos + i) > 0 && editorByteAt(pos + i) != '\n'; i++)
+        query[i] = editorByteAt(pos + i);
+    printf("kilo-bench: incremental search in %s, %.1f MB, %d threads\n", path, docLength() / 1048576.0,
+           SP.numthreads);
+    printf("%-10s %-22s %9s %9s  %s\n", "key", "query", "ms", "matches", "how");
+    E.cx = E.cy = 0;
+    editorFindStart();
+    for (i = 0; query[i]; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "'%c'", query[i]);
+        benchIncrementalKey((unsigned char)query[i], label);
+    }
+    for (i = 0; i < 10 && E.find.len; i++) benchIncrementalKey(BACKSPACE, "backspace");
+    editorFindKey('\x1b');
+    editorClose();
+}
+
+long long benchFindTimed(const char *q, int regex, size_t *hit) { // best of three first-match searches, ns
+    long long best = 0, t;
+    size_t end;
+    int r;
+    memcpy(E.find.query, q, strlen(q));
+    E.find.len = strlen(q);
+    E.find.regex = regex;
+    for (r = 0; r < 3; r++) {
+        long long t0 = benchNow();
+        *hit = editorFindIn(0, docLength(), 0, &end);
+        t = benchNow() - t0;
+        if (r == 0 || t < best) best = t;
+    }
+    return best;
+}
+
+long long benchCountTimed(const char *q, int regex, size_t *n) { // a whole-document count, ns
+    int complete;
+    long long t0 = benchNow();
+    searchSubmit(SEARCH_COUNT, q, strlen(q), regex, 0, 0, docLength());
+    *n = searchCounted(1, &complete);
+    return benchNow() - t0;
+}
+
+void benchIndex(const char *path) {         // searches with and without the trigram index
+    const char *queries[] = {"quota exceeded", "kilo_bench_absent", "GET /api/items", "timeout order=[0-9]+",
+                             "(DEBUG|WARN) +cache"};
+    const char *ins = "kilo_bench_absent";
+    size_t i, k, q, hit, hit0, n, n0;
+    int bad = 0;
+
+    setenv("KILO_INDEX", "1", 1);
+    long long t0 = benchNow();
+    editorOpen(path);                       // the builder starts here
+    while (TI.building && !__atomic_load_n(&TI.done, __ATOMIC_ACQUIRE)) {
+        struct timespec ts = {0, 1000000};
+        nanosleep(&ts, NULL);
+    }
+    triCollect();
+    long long built = benchNow() - t0;
+    if (TI.data == NULL) {
+        printf("kilo-bench: %s is not indexed (under %d MB?)\n", path, TRI_MIN >> 20);
+        editorClose();
+        return;
+    }
+    printf("kilo-bench: trigram index of %s, %.1f MB, %d threads\n", path, docLength() / 1048576.0,
+           SP.numthreads);
+    printf("built in %.0f ms, %.1f MB, %s\n", built / 1e6, TI.datalen / 1048576.0,
+           access(TI.path, F_OK) == 0 ? TI.path : "not saved");
+    editorClose();
+    unsetenv("KILO_INDEX");                 // the default: use the index that is there
+    t0 = benchNow();
+    editorOpen(path);
+    printf("reopened in %.1f ms, index %s\n", (benchNow() - t0) / 1e6, TI.mapped ? "mapped" : "rebuilding");
+
+    printf("%-22s %8s %8s %10s %10s %10s %10s\n", "query", "matches", "scanned", "first ms", "indexed",
+           "count ms", "indexed");
+    for (i = 0; i <= sizeof(queries) / sizeof(queries[0]); i++) {
+        const char *s = i < sizeof(queries) / sizeof(queries[0]) ? queries[i] : ins;
+        int regex = strpbrk(s, "[(") != NULL;
+        const unsigned char *data = TI.data;
+        size_t scanned = 0;
+        if (i == sizeof(queries) / sizeof(queries[0])) { // typed into the middle, then searched again
+            E.cy = docLineCount() / 2;
+            E.cx = 0;
+            for (k = 0; ins[k]; k++) editorInsertChar((unsigned char)ins[k]);
+            editorInsertNewline();
+        }
+        TI.data = NULL;                     // the full scan first
+        long long first0 = benchFindTimed(s, regex, &hit0), count0 = benchCountTimed(s, regex, &n0);
+        TI.data = data;
+        long long first = benchFindTimed(s, regex, &hit), count = benchCountTimed(s, regex, &n);
+        for (q = 0; q < triNarrow(s, strlen(s), regex, 0, docLength()); q++)
+            scanned += TI.ranges[2 * q + 1] - TI.ranges[2 * q];
+        bad |= hit != hit0 || n != n0;
+        printf("%-22.22s %8zu %7.1f%% %10.3f %10.3f %10.3f %10.3f%s%s\n", s, n, 100.0 * scanned / docLength(),
+               first0 / 1e6, first / 1e6, count0 / 1e6, count / 1e6, hit != hit0 || n != n0 ? "  MISMATCH" : "",
+               i == sizeof(queries) / sizeof(queries[0]) ? "  (after typing it in)" : "");
+    }
+    if (bad) printf("kilo-bench: the index changed a result\n");
+    unlink(TI.path);
+    editorClose();
+}
+
+void benchUsage(void) {
+    fprintf(stderr, "usage: kilo-bench [-s ROWSxCOLS] [-w bytes] [-b backend] [-r recording] [file]\n"
+                    "       kilo-bench -m [lines]\n"
+                    "       kilo-bench -e [edits] [file]\n"
+                    "       kilo-bench -k [-r recording]\n"
+                    "       kilo-bench [-b backend] -l [GB]\n"
+                    "       kilo-bench -n [file]\n"
+                    "       kilo-bench -f [file]\n"
+                    "       kilo-bench -t [file]\n"
+                    "       kilo-bench -i [file]\n"
+                    "       kilo-bench -x [file]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = NULL, *recording = NULL, *backend = NULL;
+    char tmp[] = "/tmp/kilo-bench-XXXXXX.c";  // highlighted as C
+    int i, failed = 0, models = 0, find = 0, scaling = 0, incremental = 0, indexed = 0, newlines = 0, decode = 0;
+    long edits = 0;
+    int load = -1;
+
+    B.rows = 50;
+    B.cols = 160;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &B.rows, &B.cols) != 2 || B.rows < 2 || B.cols < 1)
+                benchUsage();
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            if ((B.wmax = atoi(argv[++i])) == 0) benchUsage();
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            recording = argv[++i];
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            backend = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0) {
+            models = i + 1 < argc ? atoi(argv[++i]) : 5000000;
+            if (models <= 0) benchUsage();
+        } else if (strcmp(argv[i], "-e") == 0) {
+            edits = i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9' ? atol(argv[++i]) : 1000000;
+            if (edits <= 0) benchUsage();
+        } else if (strcmp(argv[i], "-l") == 0) {
+            load = i + 1 < argc && argv[i + 1][0] >= '0' && argv[i + 1][0] <= '9' ? atoi(argv[++i]) : 0;
+            if (load < 0) benchUsage();
+        } else if (strcmp(argv[i], "-k") == 0) {
+            decode = 1;
+        } else if (strcmp(argv[i], "-n") == 0) {
+            newlines = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            find = 1;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            scaling = 1;
+        } else if (strcmp(argv[i], "-i") == 0) {
+            incremental = 1;
+        } else if (strcmp(argv[i], "-x") == 0) {
+            indexed = 1;
+        } else if (argv[i][0] == '-') {
+            benchUsage();
+        } else {
+            path = argv[i];
+        }
+    }
+
+    setenv("KILO_INDEX", "0", 0);           // no builder skewing the other timings
+    initEditor();
+    A.main = pthread_self();
+    A.render = R.running ? R.thread : A.main;
+    if (backend) {                          // drop the empty document, switch storage
+        editorClose();
+        if (docSelect(backend) == -1) benchUsage();
+        docInit(NULL, 0, -1);
+    }
+    if (decode) {                           // no document involved
+        benchDecode(recording);
+        return 0;
+    }
+    if (load >= 0) {                        // its own generated files
+        benchLoad(load);
+        return 0;
+    }
+    if (path == NULL || models) {           // generated document, same every run
+        int fd = mkstemps(tmp, 2);
+        if (fd == -1) die("mkstemps");
+        close(fd);
+        if (indexed) benchLogDocument(tmp, 2500000);
+        else benchDocument(tmp, models ? models : find || scaling || incremental ? 5000000 : 200000);
+        path = tmp;
+    }
+    if (models || edits || newlines || find || scaling || incremental || indexed) {
+        if (models) benchModels(path);
+        else if (edits) benchEdits(path, edits);
+        else if (newlines) benchNewlines(path);
+        else if (find) benchFind(path);
+        else if (scaling) benchScaling(path);
+        else if (incremental) benchIncremental(path);
+        else benchIndex(path);
+        if (path == tmp) unlink(tmp);
+        return 0;
+    }
+
+    benchOpen(path);
+    printf("kilo-bench: %dx%d, %s backend, %zu bytes, %zu lines, %s output\n", B.rows, B.cols,
+           E.docops->name, docLength(), docLineCount(), E.syncoutput ? "synchronized" : "plain");
+    printf("%-10s %6s  %8s  %8s  %9s  %8s  %8s  %8s  %s\n", "workload", "keys",
+           "p50 us", "p99 us", "bytes/key", "esc/text", "sys/key", "lex/key", "screen");
+
+    if (docLineCount() > 2) failed |= benchRowGuard(2);
+    if (recording) {
+        struct script s = {0};
+        if (scriptLoad(&s, recording) == -1) die(recording);
+        failed |= benchRun("recording", path, &s);
+    } else {
+        for (i = 0; i < (int)(sizeof(benchWorkloads) / sizeof(benchWorkloads[0])); i++) {
+            struct script s = {0};
+            benchWorkloads[i].build(&s);
+            failed |= benchRun(benchWorkloads[i].name, path, &s);
+            free(s.b);
+            free(s.ends);
+        }
+    }
+
+    if (path == tmp) unlink(tmp);
+    if (V.unknown) fprintf(stderr, "kilo-bench: %lu escape sequences not emulated\n", V.unknown);
+    return failed;
+}
@@ -1,4 +1,8 @@
 /*** Includes ***/
+#define _DEFAULT_SOURCE 1       // expose POSIX/BSD extensions under -std=c99
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
 #include <ctype.h>      // character classification (iscntrl, isdigit, etc.)
 #include <errno.h>      // errno values like EAGAIN for non-blocking read
 #include <stdio.h>      // perror(), snprintf()
@@ -6,12 +10,33 @@
 #include <termios.h>    // terminal control (raw vs canonical mode)
 #include <unistd.h>     // read(), write(), STDIN_FILENO, STDOUT_FILENO
 #include <sys/ioctl.h>  // ioctl(), TIOCGWINSZ for terminal size
-#include <string.h>     // memcpy()
+#include <string.h>     // memcpy(), memchr(), memmove()
+#include <fcntl.h>      // open(), O_RDONLY
+#include <sys/stat.h>   // fstat() for file size
+#include <sys/types.h>  // ssize_t, off_t
+#include <sys/mman.h>   // mmap(), munmap() for zero-copy file open
+#include <stdint.h>     // SIZE_MAX
+#include <pthread.h>    // background line indexing
+#include <time.h>       // nanosleep(), clock_gettime()
+#include <poll.h>       // poll() event loop
+#include <signal.h>     // sigaction() for SIGWINCH
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define KILO_SIMD_X86 1         // SSE2/AVX2 kernels, picked at runtime
+#include <immintrin.h>  // SSE2/AVX2 intrinsics
+#endif
 
 /*** Macros ***/
 #define CTRL_KEY(k) ((k) & 0x1f)   // maps Ctrl+<key> to ASCII control code
 #define KILO_VERSION "0.0.1"       // editor version strig
+#define KILO_TAB_STOP 8            // columns per tab stop when rendering
+#ifdef __APPLE__                   // struct stat's modification time, in nanoseconds
+#define STAT_MTIME_NS(st) ((uint64_t)(st)->st_mtimespec.tv_sec * 1000000000 + (st)->st_mtimespec.tv_nsec)
+#else
+#define STAT_MTIME_NS(st) ((uint64_t)(st)->st_mtim.tv_sec * 1000000000 + (st)->st_mtim.tv_nsec)
+#endif
 enum editorKey {
+  BACKSPACE = 127,
   ARROW_LEFT = 1000,
   ARROW_RIGHT,
   ARROW_UP,
@@ -20,161 +45,4683 @@ enum editorKey {
   HOME_KEY,
   END_KEY,
   PAGE_UP,
-  PAGE_DOWN
+  PAGE_DOWN,
+  CURSOR_REPORT,                   // terminal's reply to a position query
+  MODE_REPORT,                     // terminal's reply to a DECRQM mode query
+  PASTE_START                      // bracketed paste begins, text follows
 };
+#define KEY_UNICODE 0x200000       // KEY_UNICODE | codepoint for non-ASCII text
+#define KEY_SHIFT   0x400000       // modifier bits reported with special keys
+#define KEY_ALT     0x800000
+#define KEY_CTRL    0x1000000
+#define KEY_MODS    (KEY_SHIFT | KEY_ALT | KEY_CTRL)
+#define KEY_PENDING (-1)           // decoder needs more bytes
+#define KEY_NONE    (-2)           // no complete key is buffered, wait for the next event
 /*** Global Data ***/
+struct piece {                     // one run of document text
+    const char *p;                 // piece text (original file or add block)
+    size_t len;                    // piece length in bytes
+    size_t nl;                     // newlines inside the piece, or PT_NLUNKNOWN
+};
+
+struct addBlock {                  // chunk of the append-only add buffer
+    char *b;                       // block storage, never moved once allocated
+    size_t len;                    // bytes used
+    size_t cap;                    // bytes allocated
+};
+
+struct lineIndex {                 // newline counts of the original buffer
+    size_t *cum;                   // cum[b]: newlines before block b
+    size_t numblocks;              // blocks of LI_BLOCK bytes
+    size_t indexed;                // bytes covered, published by the indexer
+    const char *base;              // buffer being indexed
+    size_t len;                    // buffer length
+    int notifyfd;                  // written when progress moves, -1 for none
+    pthread_t thread;              // background indexer
+    int running;                   // thread was started
+    int stop;                      // ask the indexer to quit
+};
+
+struct pieceTable {                // document storage
+    const char *orig;              // original file contents, read-only
+    size_t origlen;                // original file length
+    struct lineIndex idx;          // line index over the original buffer
+    struct addBlock *blocks;       // append-only add buffer
+    int numblocks;                 // add blocks in use
+    struct piece *pieces;          // piece list in document order
+    int numpieces;                 // pieces in use
+    int cappieces;                 // pieces allocated
+    size_t len;                    // document length in bytes
+    int hint;                      // last piece located (edits are local)
+    size_t hintpos;                // document offset of pieces[hint]
+};
+
+#define ROPE_FANOUT 16             // children per inner rope node
+
+struct ropeNode {                  // rope leaf (text chunk) or inner node
+    size_t bytes;                  // bytes below this node
+    size_t lines;                  // newlines below this node
+    int leaf;                      // leaf holds text, inner node holds kids
+    int n;                         // kids in use
+    struct ropeNode *kids[ROPE_FANOUT]; // children, inner nodes only
+    const char *text;              // leaf text: original buffer or own
+    char *own;                     // leaf's private copy once edited, else NULL
+};
+
+struct rope {                      // B+ tree of text chunks with cached counts
+    struct ropeNode *root;         // always present, an empty leaf when empty
+};
+
+struct textRow {                   // one line of a row array, without its '\n'
+    char *chars;                   // text before the gap, the gap, text after it
+    size_t len;                    // text bytes, gap excluded
+    size_t gap;                    // gap offset: text bytes before it
+    size_t gaplen;                 // free bytes in the gap
+};
+
+struct rowArray {                  // the classic editor layout: one malloc per line
+    struct textRow *rows;          // lines in order, at least one
+    size_t numrows, caprows;
+    size_t *offs;                  // offs[i]: document offset of row i
+    size_t numvalid;               // offs[] is correct below this row
+    size_t len;                    // document length in bytes
+};
+
+struct editorSyntax {              // how to highlight one language
+    const char *name;              // shown in the status bar
+    const char **filematch;        // file name suffixes
+    const char **keywords;         // type names end in '|'
+    const char *comment;           // single-line comment start
+    const char *mlstart, *mlend;   // block comment delimiters
+};
+
+#define HL_ROWS 256                // cached rows, a power of two above the screen height
+
+struct hlRow {                     // highlight of one line, kept while it is on screen
+    size_t line;                   // document line, HL_NONE when unused
+    int state;                     // lexer state the line was lexed from
+    size_t upto;                   // bytes lexed from the line start, HL_NONE if shown plain
+    unsigned char *hl;             // ATTR_* per byte
+    size_t len, cap;
+};
+
+enum hlJobOp { HL_JOB_ROWS, HL_JOB_STATES }; // the worker serves visible rows first
+
+struct hlJob {                     // lines copied out for the highlight worker
+    int op;                        // HL_JOB_*
+    unsigned gen;                  // highlighter generation the text was copied in
+    const struct editorSyntax *syntax;
+    size_t line;                   // first line
+    size_t numlines;
+    char *text;                    // the lines back to back, without their '\n'
+    size_t len, cap;
+    size_t *lens;                  // bytes copied per line, HL_NONE for a line shown plain
+    unsigned char *entry;          // state each line starts in (states jobs: first line only)
+    unsigned char *ends;           // in: stored end states, out: state each line ends in
+    size_t numold;                 // lines that have a stored end state
+    size_t converge;               // from this line on, ending as stored finishes the job
+    unsigned char *hl;             // out, rows jobs: ATTR_* per byte of text
+    size_t linecap, hlcap;
+};
+
+#define HL_QUEUE 4                 // slots per job queue, a power of two
+
+struct hlQueue {                   // lock-free, one producer, one consumer
+    struct hlJob *slot[HL_QUEUE];
+    unsigned head;                 // advanced by the producer only
+    unsigned tail;                 // advanced by the consumer only
+};
+
+struct highlighter {               // incremental syntax highlighting
+    const struct editorSyntax *syntax; // NULL for plain text
+    unsigned char *state;          // state[i]: lexer state at the end of line i
+    size_t numstates;              // lines with a stored end state
+    size_t cap;
+    size_t stale;                  // first stored state that may be wrong, HL_NONE if none
+    size_t staleend;               // lines from here on were not edited
+    struct hlRow rows[HL_ROWS];    // indexed by line % HL_ROWS
+    unsigned gen;                  // bumped by every edit, older jobs are dropped
+    struct hlJob jobs[2];          // one job of each kind, reused
+    int busy[2];                   // jobs[op] is with the worker
+    size_t cutline, cutpos;        // line and offset after the last states job, HL_NONE after an edit
+    struct hlQueue todo[2];        // main -> worker, one queue per kind
+    struct hlQueue done;           // worker -> main: finished jobs
+    int wake[2];                   // the worker blocks reading wake[0]
+    int notify[2];                 // written when a job is done, watched by the event loop
+    pthread_t thread;
+    int running;                   // worker was started
+    unsigned long lexed;           // lines lexed so far
+};
+
+#define DOC_NOLINE ((size_t)-1)    // line does not exist
+#define DOC_UNKNOWN ((size_t)-1)   // line count not known while indexing
+
+struct docBackend {                // document storage, chosen at startup
+    const char *name;              // KILO_BACKEND value
+    void (*init)(const char *orig, size_t len, int notifyfd); // wrap file contents
+    void (*free)(void);            // drop the document
+    void (*insert)(size_t pos, const char *s, size_t len);
+    void (*del)(size_t pos, size_t len);
+    const char *(*span)(size_t pos, size_t *len); // contiguous text at pos
+    size_t (*lineStart)(size_t line); // offset of a line, DOC_NOLINE past the end
+    size_t (*lineCount)(void);     // lines, DOC_UNKNOWN while indexing
+    size_t (*length)(void);        // bytes
+    int (*progress)(void);         // percent indexed
+};
+
+struct docSpanRef {                // one contiguous run of document text
+    size_t pos;                    // document offset of p[0]
+    const char *p;
+    size_t len;
+};
+
+struct docView {                   // the spans of one version of the document, for other threads
+    struct docSpanRef *spans;      // in document order, runs adjacent in memory merged
+    size_t numspans, cap;
+    size_t len;                    // document length
+    unsigned long version;         // E.docversion when taken
+};
+
+#define ATTR_NORMAL 0              // default colors
+#define ATTR_INVERSE 1             // status bar
+#define ATTR_COMMENT 2             // syntax classes from the highlighter
+#define ATTR_KEYWORD1 3
+#define ATTR_KEYWORD2 4
+#define ATTR_STRING 5
+#define ATTR_NUMBER 6
+#define ATTR_MATCH 7               // search match
+
+#define FIND_MAX 256               // longest search query in bytes
+#define FIND_NONE ((size_t)-1)     // no match
+#define FIND_SET_MAX (1 << 18)     // matches kept for one prefix of a query
+
+struct findSet {                   // every place a prefix of the query matches
+    size_t *pos;                   // ascending, overlapping matches too
+    size_t n, cap;
+    size_t matches;                // those marked on screen: no two overlap
+    int valid;
+};
+
+struct finder {                    // Ctrl-F search
+    int active;                    // prompt is open, keys go to the query
+    char query[FIND_MAX];          // text typed so far
+    size_t len;                    // bytes in query
+    int regex;                     // query is a regular expression
+    const char *error;             // why the regex does not compile, or NULL
+    size_t match;                  // offset of the match shown, or FIND_NONE
+    size_t matchend;               // offset just past it
+    size_t origin;                 // where typing searches from
+    size_t cx, cy, rowoff, coloff; // view to go back to on Esc
+    char *rowtext;                 // visible part of a line being drawn
+    unsigned char *rowattr;        // its attributes, matches marked
+    size_t rowcap;                 // bytes allocated for both
+    struct findSet sets[FIND_MAX + 1]; // sets[k]: query[0..k), plain text only
+    struct findSet *set;           // the whole query's, when one is known
+};
+
+struct cell {                      // one character cell on screen
+    char ch[4];                    // UTF-8 bytes of the character
+    unsigned char len;             // bytes used in ch
+    unsigned char attr;            // ATTR_* display attribute
+};
+
+struct screenGrid {                // front/back frames for differential output
+    struct cell *front;            // what the terminal currently shows
+    struct cell *back;             // snapshot being sent
+    int rows, cols;                // grid size
+    int valid;                     // front is known to match the terminal
+    int cy, cx;                    // terminal cursor, -1 when unknown
+    int attr;                      // attribute in effect on the terminal
+};
+
+struct frameStats {                // output instrumentation
+    unsigned long frames;          // frames written
+    unsigned long long bytes;      // bytes written over all frames
+    int last;                      // bytes in the last frame
+};
+
+struct abuf {                      // append buffer for terminal output
+    char *b;                       // pointer to buffer
+    int len;                       // bytes used
+    int cap;                       // bytes allocated, kept across frames
+    unsigned long grows;           // reallocations so far
+};
+
+#define ABUF_INIT {NULL, 0, 0, 0}  // initialize empty buffer
+#define ABUF_MIN 4096              // first allocation
+#define ABUF_CELL 16               // bytes per screen cell reserved on a resize
+
+#define INPUT_BUFSIZE 4096         // bytes read per syscall
+#define INPUT_MAXPARAMS 8          // CSI parameters kept
+
+struct inputDecoder {              // buffered stdin and escape-sequence state
+    unsigned char buf[INPUT_BUFSIZE]; // bytes read but not decoded yet
+    int len, pos;                  // valid bytes, next byte to decode
+    int state;                     // IS_* decoder state
+    int params[INPUT_MAXPARAMS];   // CSI/SS3 numeric parameters
+    int numparams;                 // parameters seen so far
+    int priv, inter;               // CSI private marker and intermediate byte
+    int cp, need;                  // UTF-8 codepoint so far, bytes still expected
+    int cprwait;                   // a cursor position query is outstanding
+    int full;                      // last read filled the buffer, more may be waiting
+    int pasting;                   // inside a bracketed paste, its text is set aside
+    char *paste;                   // pasted bytes so far
+    size_t pastelen, pastecap;     // bytes used and allocated
+};
+
 struct editorConfig {
-    int cx,cy;                     // cursor coordinates
+    size_t cx,cy;                  // cursor coordinates (byte in line, line)
+    size_t rx;                     // cursor render column (tabs expanded)
+    size_t rowoff;                 // first document line on screen
+    size_t coloff;                 // first render column on screen
+    int indexshown;                // indexing progress last drawn, percent
     int screenrows;                // number of terminal rows
     int screencols;                // number of terminal columns
+    const struct docBackend *docops; // storage backend holding the document
+    unsigned long docversion;      // bumped by every change to the document
+    struct pieceTable pt;          // piece table backend
+    struct rope rope;              // rope backend
+    struct rowArray rows;          // row array backend
+    struct highlighter hl;         // syntax highlighting state
+    struct finder find;            // search prompt
+    struct screenGrid grid;        // screen contents
+    struct frameStats stats;       // bytes sent per frame
+    struct abuf frame;             // output arena reused by every frame
+    int dirty;                     // screen needs a refresh
+    int framems;                   // shortest time between frames, 0 for no cap
+    long long nextframe;           // evNow() at which the next frame may be drawn
+    int framepending;              // a timer will wake the loop for the next frame
+    long long hlwait;              // evNow() until which a frame waits for visible highlights, 0 if none
+    int resizepending;             // SIGWINCH seen, size not re-read yet
+    int syncoutput;                // terminal supports synchronized output (mode 2026)
+    int winchpipe[2];              // SIGWINCH self-pipe
+    int workerpipe[2];             // background threads report progress here
+    char *filename;                // open file, NULL for an empty buffer
+    void *filemap;                 // read-only mapping of the open file
+    size_t filemaplen;             // length of the mapping
+    struct inputDecoder in;        // keyboard input
     struct termios orig_termios;   // original terminal settings backup
 };
 
-struct editorConfig E;             // global editor state
+struct editorConfig E;             // global editor state
+
+/*** Terminal Control ***/
+void die(const char *s) {           // fatal error handler
+    write(STDOUT_FILENO, "\x1b[2J", 4);  // clear entire screen
+    write(STDOUT_FILENO, "\x1b[H", 3);   // move cursor to top-left
+    write(STDOUT_FILENO, "\x1b[?1049l", 8); // leave the alternate screen so the message stays
+    perror(s);                           // print error message
+    exit(1);                             // exit with failure
+}
+
+void termWrite(const char *buf, size_t len) { // all of buf, however the tty takes it
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n > 0) {                         // partial writes continue where they stopped
+            buf += n;
+            len -= n;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            struct pollfd pfd = {STDOUT_FILENO, POLLOUT, 0};
+            poll(&pfd, 1, -1);               // wait for the terminal to drain
+        } else if (n == -1 && errno != EINTR) {
+            die("write");
+        }
+    }
+}
+
+void disableRawMode(void) {          // restore terminal settings
+    write(STDOUT_FILENO, "\x1b[?2004l\x1b[?1049l", 16); // plain pastes, normal screen
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios); // reset terminal mode
+}
+
+void enableRawMode(void) {            // enable raw input mode
+    tcgetattr(STDIN_FILENO, &E.orig_termios); // save current terminal state
+    atexit(disableRawMode);                   // restore terminal on exit
+
+    struct termios raw = E.orig_termios;      // copy terminal attributes
+
+    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON); // disable input processing
+    raw.c_oflag &= ~(OPOST);                                 // disable output processing
+    raw.c_cflag |= (CS8);                                   // force 8-bit characters
+    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);        // disable echo, canonical mode, signals
+
+    raw.c_cc[VMIN] = 0;       // read() returns immediately
+    raw.c_cc[VTIME] = 1;      // escape tails wait up to 100ms; idle waiting is poll()'s job
+
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw); // apply raw mode
+    write(STDOUT_FILENO, "\x1b[?1049h", 8);   // alternate screen: no scrollback to shift on resize
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);   // bracketed paste: pasted text arrives as one block
+}
+
+/*** Input Decoding ***/
+/* stdin is read up to INPUT_BUFSIZE bytes per syscall and decoded by a
+   table-driven state machine: each byte maps to a class, and the
+   (state, class) entry gives the next state and the action to take.
+   It covers CSI and SS3 sequences with xterm modifier parameters and
+   UTF-8 multibyte text. */
+#define INPUT_ESC_TIMEOUT 25                // ms to wait for the rest of a sequence
+#define INPUT_PASTE_TIMEOUT 1000            // ms of silence that ends a paste missing its end marker
+
+enum inputState { IS_GROUND, IS_ESC, IS_CSI, IS_SS3, IS_UTF8, IS_COUNT };
+enum inputClass {
+    IC_CTRL, IC_ESC, IC_DIGIT, IC_SEP, IC_PRIV, IC_INTER, IC_LBRACKET, IC_O,
+    IC_FINAL, IC_CONT, IC_LEAD2, IC_LEAD3, IC_LEAD4, IC_BAD, IC_COUNT
+};
+enum inputAction {
+    IA_EMIT,                                // the byte is the key
+    IA_START,                               // ESC: reset sequence state
+    IA_ESC,                                 // ESC ESC: report the first one
+    IA_ALT,                                 // ESC + byte: Alt-modified key
+    IA_NONE,                                // just change state
+    IA_PARAM, IA_SEP, IA_PRIV, IA_INTER,    // collect CSI/SS3 parameters
+    IA_CSI, IA_SS3,                         // final byte: dispatch the sequence
+    IA_UTF8, IA_UTF8CONT,                   // multibyte text
+    IA_BAD,                                 // invalid UTF-8 byte
+    IA_ESC_REDO,                            // lone ESC, then redo the byte
+    IA_SEQ_REDO,                            // drop a broken sequence, redo the byte
+    IA_UTF8_REDO                            // truncated UTF-8, then redo the byte
+};
+
+struct inputTransition {
+    unsigned char next;                     // state after this byte
+    unsigned char action;                   // IA_* to run
+};
+
+#define T(s, a) {s, a}
+const struct inputTransition inputTable[IS_COUNT][IC_COUNT] = {
+    [IS_GROUND] = {
+        [IC_CTRL] = T(IS_GROUND, IA_EMIT), [IC_ESC] = T(IS_ESC, IA_START),
+        [IC_DIGIT] = T(IS_GROUND, IA_EMIT), [IC_SEP] = T(IS_GROUND, IA_EMIT),
+        [IC_PRIV] = T(IS_GROUND, IA_EMIT), [IC_INTER] = T(IS_GROUND, IA_EMIT),
+        [IC_LBRACKET] = T(IS_GROUND, IA_EMIT), [IC_O] = T(IS_GROUND, IA_EMIT),
+        [IC_FINAL] = T(IS_GROUND, IA_EMIT), [IC_CONT] = T(IS_GROUND, IA_BAD),
+        [IC_LEAD2] = T(IS_UTF8, IA_UTF8), [IC_LEAD3] = T(IS_UTF8, IA_UTF8),
+        [IC_LEAD4] = T(IS_UTF8, IA_UTF8), [IC_BAD] = T(IS_GROUND, IA_BAD),
+    },
+    [IS_ESC] = {
+        [IC_CTRL] = T(IS_GROUND, IA_ALT), [IC_ESC] = T(IS_ESC, IA_ESC),
+        [IC_DIGIT] = T(IS_GROUND, IA_ALT), [IC_SEP] = T(IS_GROUND, IA_ALT),
+        [IC_PRIV] = T(IS_GROUND, IA_ALT), [IC_INTER] = T(IS_GROUND, IA_ALT),
+        [IC_LBRACKET] = T(IS_CSI, IA_NONE), [IC_O] = T(IS_SS3, IA_NONE),
+        [IC_FINAL] = T(IS_GROUND, IA_ALT), [IC_CONT] = T(IS_GROUND, IA_ESC_REDO),
+        [IC_LEAD2] = T(IS_GROUND, IA_ESC_REDO), [IC_LEAD3] = T(IS_GROUND, IA_ESC_REDO),
+        [IC_LEAD4] = T(IS_GROUND, IA_ESC_REDO), [IC_BAD] = T(IS_GROUND, IA_ESC_REDO),
+    },
+    [IS_CSI] = {
+        [IC_CTRL] = T(IS_GROUND, IA_SEQ_REDO), [IC_ESC] = T(IS_ESC, IA_START),
+        [IC_DIGIT] = T(IS_CSI, IA_PARAM), [IC_SEP] = T(IS_CSI, IA_SEP),
+        [IC_PRIV] = T(IS_CSI, IA_PRIV), [IC_INTER] = T(IS_CSI, IA_INTER),
+        [IC_LBRACKET] = T(IS_GROUND, IA_CSI), [IC_O] = T(IS_GROUND, IA_CSI),
+        [IC_FINAL] = T(IS_GROUND, IA_CSI), [IC_CONT] = T(IS_GROUND, IA_SEQ_REDO),
+        [IC_LEAD2] = T(IS_GROUND, IA_SEQ_REDO), [IC_LEAD3] = T(IS_GROUND, IA_SEQ_REDO),
+        [IC_LEAD4] = T(IS_GROUND, IA_SEQ_REDO), [IC_BAD] = T(IS_GROUND, IA_SEQ_REDO),
+    },
+    [IS_SS3] = {
+        [IC_CTRL] = T(IS_GROUND, IA_SEQ_REDO), [IC_ESC] = T(IS_ESC, IA_START),
+        [IC_DIGIT] = T(IS_SS3, IA_PARAM), [IC_SEP] = T(IS_SS3, IA_SEP),
+        [IC_PRIV] = T(IS_GROUND, IA_SEQ_REDO), [IC_INTER] = T(IS_GROUND, IA_SEQ_REDO),
+        [IC_LBRACKET] = T(IS_GROUND, IA_SS3), [IC_O] = T(IS_GROUND, IA_SS3),
+        [IC_FINAL] = T(IS_GROUND, IA_SS3), [IC_CONT] = T(IS_GROUND, IA_SEQ_REDO),
+        [IC_LEAD2] = T(IS_GROUND, IA_SEQ_REDO), [IC_LEAD3] = T(IS_GROUND, IA_SEQ_REDO),
+        [IC_LEAD4] = T(IS_GROUND, IA_SEQ_REDO), [IC_BAD] = T(IS_GROUND, IA_SEQ_REDO),
+    },
+    [IS_UTF8] = {
+        [IC_CTRL] = T(IS_GROUND, IA_UTF8_REDO), [IC_ESC] = T(IS_GROUND, IA_UTF8_REDO),
+        [IC_DIGIT] = T(IS_GROUND, IA_UTF8_REDO), [IC_SEP] = T(IS_GROUND, IA_UTF8_REDO),
+        [IC_PRIV] = T(IS_GROUND, IA_UTF8_REDO), [IC_INTER] = T(IS_GROUND, IA_UTF8_REDO),
+        [IC_LBRACKET] = T(IS_GROUND, IA_UTF8_REDO), [IC_O] = T(IS_GROUND, IA_UTF8_REDO),
+        [IC_FINAL] = T(IS_GROUND, IA_UTF8_REDO), [IC_CONT] = T(IS_UTF8, IA_UTF8CONT),
+        [IC_LEAD2] = T(IS_GROUND, IA_UTF8_REDO), [IC_LEAD3] = T(IS_GROUND, IA_UTF8_REDO),
+        [IC_LEAD4] = T(IS_GROUND, IA_UTF8_REDO), [IC_BAD] = T(IS_GROUND, IA_UTF8_REDO),
+    },
+};
+#undef T
+
+const int csiFinalKeys[128] = {             // CSI <mods> final
+    ['A'] = ARROW_UP, ['B'] = ARROW_DOWN, ['C'] = ARROW_RIGHT, ['D'] = ARROW_LEFT,
+    ['H'] = HOME_KEY, ['F'] = END_KEY,
+};
+
+const int csiTildeKeys[] = {                // CSI <n> ~
+    0, HOME_KEY, 0, DEL_KEY, END_KEY, PAGE_UP, PAGE_DOWN, HOME_KEY, END_KEY,
+};
+
+unsigned char inputClass[256];              // byte -> IC_* class
+
+void inputInit(void) {                      // build the byte class table
+    int c;
+    for (c = 0; c < 256; c++) {
+        if (c < 0x20 || c == 0x7f) inputClass[c] = IC_CTRL;
+        else if (c < 0x30) inputClass[c] = IC_INTER;
+        else if (c <= '9') inputClass[c] = IC_DIGIT;
+        else if (c <= ';') inputClass[c] = IC_SEP;
+        else if (c < 0x40) inputClass[c] = IC_PRIV;
+        else if (c < 0x7f) inputClass[c] = IC_FINAL;
+        else if (c < 0xc0) inputClass[c] = IC_CONT;
+        else if (c < 0xc2) inputClass[c] = IC_BAD;
+        else if (c < 0xe0) inputClass[c] = IC_LEAD2;
+        else if (c < 0xf0) inputClass[c] = IC_LEAD3;
+        else if (c < 0xf5) inputClass[c] = IC_LEAD4;
+        else inputClass[c] = IC_BAD;
+    }
+    inputClass['\x1b'] = IC_ESC;
+    inputClass['['] = IC_LBRACKET;
+    inputClass['O'] = IC_O;
+    E.in.len = E.in.pos = 0;
+    E.in.state = IS_GROUND;
+    E.in.pasting = 0;
+}
+
+int inputModifiers(void) {                  // xterm modifier parameter to KEY_* bits
+    struct inputDecoder *d = &E.in;
+    int m = d->numparams > 1 ? d->params[1] - 1 : 0;
+    if (m <= 0) return 0;
+    return (m & 1 ? KEY_SHIFT : 0) | (m & 2 ? KEY_ALT : 0) | (m & 4 ? KEY_CTRL : 0);
+}
+
+int inputDispatch(int final, int ss3) {     // complete sequence to a key
+    struct inputDecoder *d = &E.in;
+    int key = 0;
+    if (final == 'R' && !ss3 && d->cprwait && d->numparams == 2 && !d->priv) {
+        d->cprwait = 0;                     // "\x1b[row;colR": position in params
+        return CURSOR_REPORT;
+    }
+    if (final == 'y' && !ss3 && d->priv == '?' && d->inter == '$' && d->numparams == 2)
+        return MODE_REPORT;                 // "\x1b[?mode;state$y": both in params
+    if (d->priv || d->inter) return KEY_PENDING; // replies and private modes: ignore
+    if (final == '~' && !ss3 && d->params[0] == 200) return PASTE_START; // 201~ ends it
+    if (final == '~' && !ss3) {
+        if (d->params[0] < (int)(sizeof(csiTildeKeys) / sizeof(csiTildeKeys[0])))
+            key = csiTildeKeys[d->params[0]];
+    } else if (final < 128) {
+        key = csiFinalKeys[final];
+    }
+    return key ? key | inputModifiers() : KEY_PENDING; // unknown: skip it
+}
+
+int inputPasteTake(int ended) {             // set buffered paste text aside, PASTE_START at its end
+    struct inputDecoder *d = &E.in;
+    unsigned char *p = d->buf + d->pos, *end = memmem(p, d->len - d->pos, "\x1b[201~", 6);
+    size_t n = end ? (size_t)(end - p) : (size_t)(d->len - d->pos);
+    if (end == NULL && !ended) n = n > 5 ? n - 5 : 0; // the marker may straddle two reads
+    if (d->paste == NULL || d->pastelen + n > d->pastecap) {
+        if (d->pastecap == 0) d->pastecap = INPUT_BUFSIZE;
+        while (d->pastelen + n > d->pastecap) d->pastecap *= 2;
+        if ((d->paste = realloc(d->paste, d->pastecap)) == NULL) die("realloc");
+    }
+    memcpy(d->paste + d->pastelen, p, n);
+    d->pastelen += n;
+    d->pos += n;
+    if (end == NULL && !ended) return KEY_PENDING;
+    if (end != NULL) d->pos += 6;           // keys typed after the paste stay buffered
+    d->pasting = 0;
+    return PASTE_START;
+}
+
+int inputDecode(void) {                     // next key from buffered bytes
+    struct inputDecoder *d = &E.in;
+    if (d->pasting) return inputPasteTake(0);
+    while (d->pos < d->len) {
+        int c = d->buf[d->pos++], key;
+        int prev = d->state;
+        const struct inputTransition *t = &inputTable[prev][inputClass[c]];
+        d->state = t->next;
+        switch (t->action) {
+            case IA_EMIT: return c;
+            case IA_START:
+                d->numparams = 0;
+                d->params[0] = 0;
+                d->priv = d->inter = 0;
+                break;
+            case IA_ESC: return '\x1b';
+            case IA_ALT: return KEY_ALT | c;
+            case IA_NONE: break;
+            case IA_PARAM:
+                if (d->numparams == 0) d->numparams = 1;
+                if (d->params[d->numparams - 1] < 100000)
+                    d->params[d->numparams - 1] = d->params[d->numparams - 1] * 10 + c - '0';
+                break;
+            case IA_SEP:
+                if (d->numparams == 0) d->numparams = 1;
+                if (d->numparams < INPUT_MAXPARAMS) d->params[d->numparams++] = 0;
+                break;
+            case IA_PRIV: d->priv = c; break;
+            case IA_INTER: d->inter = c; break;
+            case IA_CSI:
+            case IA_SS3:
+                key = inputDispatch(c, t->action == IA_SS3);
+                if (key == PASTE_START) {   // reported once the text has all arrived
+                    d->pasting = 1;
+                    d->pastelen = 0;
+                    return inputPasteTake(0);
+                }
+                if (key != KEY_PENDING) return key;
+                break;
+            case IA_UTF8:
+                d->need = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+                d->cp = c & (0x3f >> d->need);
+                break;
+            case IA_UTF8CONT:
+                d->cp = (d->cp << 6) | (c & 0x3f);
+                if (--d->need == 0) {
+                    d->state = IS_GROUND;
+                    return KEY_UNICODE | d->cp;
+                }
+                break;
+            case IA_BAD: return KEY_UNICODE | 0xfffd;
+            case IA_ESC_REDO: d->pos--; return '\x1b';
+            case IA_SEQ_REDO: d->pos--; break;
+            case IA_UTF8_REDO: d->pos--; return KEY_UNICODE | 0xfffd;
+        }
+    }
+    return KEY_PENDING;
+}
+
+int inputFlush(void) {                      // sequence or paste timed out: report what we have
+    if (E.in.pasting) return inputPasteTake(1); // no end marker: the paste is what arrived
+    int state = E.in.state;
+    E.in.state = IS_GROUND;
+    if (state == IS_UTF8) return KEY_UNICODE | 0xfffd;
+    return '\x1b';                          // lone ESC or a cut-off sequence
+}
+
+int inputFill(int timeout) {                // read a block of input, 0 on timeout
+    struct inputDecoder *d = &E.in;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    if (d->pos == d->len) d->pos = d->len = 0;
+    if (d->pos > 0) {                       // keep the undecoded tail at the front
+        memmove(d->buf, d->buf + d->pos, d->len - d->pos);
+        d->len -= d->pos;
+        d->pos = 0;
+    }
+    if (d->len == INPUT_BUFSIZE) return 0;
+    int n = poll(&pfd, 1, timeout);
+    if (n == -1 && errno != EINTR) die("poll");
+    if (n <= 0) return 0;
+    n = read(STDIN_FILENO, d->buf + d->len, INPUT_BUFSIZE - d->len);
+    if (n == -1 && errno != EAGAIN && errno != EINTR) die("read");
+    if (n <= 0) return 0;
+    d->len += n;
+    d->full = d->len == INPUT_BUFSIZE;
+    return n;
+}
+
+char *inputPaste(size_t *len) {            // text of the paste just decoded, the caller frees it
+    char *p = E.in.paste;
+    *len = E.in.pastelen;
+    E.in.paste = NULL;
+    E.in.pastelen = E.in.pastecap = 0;
+    return p;
+}
+
+int inputPartial(void) {                    // a sequence or paste is waiting for more bytes
+    return E.in.state != IS_GROUND || E.in.pasting;
+}
+
+int editorReadKey(void) {                   // next buffered key, KEY_NONE if there is none
+    int key = inputDecode();
+    return key == KEY_PENDING ? KEY_NONE : key; // evWait() waits for the rest
+}
+
+int getWindowSize(int *rows, int *cols) {   // get terminal size, -1 if the ioctl can't tell
+    struct winsize ws;                      // window size struct
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) return -1;
+    *cols = ws.ws_col;                      // store columns
+    *rows = ws.ws_row;                      // store rows
+    return 0;
+}
+
+/*** Event Loop ***/
+/* The main loop sleeps in poll() until a watched descriptor is readable or
+   the nearest timer expires, so an idle editor makes no wakeups. stdin,
+   the SIGWINCH self-pipe and the worker pipe are all just descriptors;
+   handlers set E.dirty when the screen has to change. */
+#define EV_MAX_FDS 8                        // watched descriptors
+#define EV_MAX_TIMERS 8                     // pending one-shot timers
+
+struct evTimer {
+    long long when;                         // deadline, monotonic ms
+    void (*fn)(void);                       // callback
+};
+
+struct evLoop {
+    struct pollfd fds[EV_MAX_FDS];          // descriptors passed to poll()
+    void (*handlers[EV_MAX_FDS])(int fd);   // called when fds[i] is readable
+    int numfds;
+    struct evTimer timers[EV_MAX_TIMERS];
+    int numtimers;
+};
+
+struct evLoop EV;                           // the editor's event loop
+
+long long evNow(void) {                     // monotonic clock in milliseconds
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void evAddFd(int fd, void (*fn)(int fd)) {  // watch fd for input
+    if (EV.numfds == EV_MAX_FDS) die("evAddFd");
+    EV.fds[EV.numfds].fd = fd;
+    EV.fds[EV.numfds].events = POLLIN;
+    EV.handlers[EV.numfds++] = fn;
+}
+
+void evAddTimer(long long ms, void (*fn)(void)) { // run fn once after ms
+    int i;
+    for (i = 0; i < EV.numtimers; i++)      // one pending timer per callback
+        if (EV.timers[i].fn == fn) break;
+    if (i == EV_MAX_TIMERS) die("evAddTimer");
+    if (i == EV.numtimers) EV.numtimers++;
+    EV.timers[i].when = evNow() + ms;
+    EV.timers[i].fn = fn;
+}
+
+void evWait(void) {                         // sleep until something happens, dispatch it
+    int timeout = -1, i, n;
+    long long now = evNow();
+    for (i = 0; i < EV.numtimers; i++) {    // sleep no longer than the nearest timer
+        long long left = EV.timers[i].when - now;
+        if (left < 0) left = 0;
+        if (timeout == -1 || left < timeout) timeout = (int)left;
+    }
+
+    n = poll(EV.fds, EV.numfds, timeout);
+    if (n == -1 && errno != EINTR) die("poll");
+    for (i = 0; n > 0 && i < EV.numfds; i++) {
+        if (EV.fds[i].revents & (POLLIN | POLLHUP | POLLERR)) EV.handlers[i](EV.fds[i].fd);
+    }
+
+    now = evNow();
+    for (i = 0; i < EV.numtimers; ) {       // fire expired timers
+        if (EV.timers[i].when <= now) {
+            void (*fn)(void) = EV.timers[i].fn;
+            EV.timers[i] = EV.timers[--EV.numtimers];
+            fn();
+        } else {
+            i++;
+        }
+    }
+}
+
+void makePipe(int fds[2]) {                 // non-blocking pipe for wakeups
+    int j;
+    if (pipe(fds) == -1) die("pipe");
+    for (j = 0; j < 2; j++) {
+        fcntl(fds[j], F_SETFL, fcntl(fds[j], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[j], F_SETFD, FD_CLOEXEC);
+    }
+}
+
+void drainPipe(int fd) {                    // discard queued wakeup bytes
+    char buf[64];
+    while (read(fd, buf, sizeof(buf)) > 0);
+}
+
+/*** Newline Scanning ***/
+/* One kernel finds the k-th newline in a range, or counts all of them when
+   k is SIZE_MAX. A count never looks for where the newlines are: it adds
+   the vector compares into byte counters and sums those every 255 vectors.
+   The widest variant the CPU supports is chosen once at startup. */
+const char *nlScanScalar(const char *p, size_t len, size_t k, size_t *seen) {
+    const char *end = p + len;
+    size_t n = 0;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        if (++n == k) return p;
+        p++;
+    }
+    if (seen) *seen = n;                    // newlines in the whole range
+    return NULL;
+}
+
+const char *nlLast(const char *p, size_t len) { // last newline in a range, NULL if none
+    while (len--)                           // memrchr() is a GNU extension
+        if (p[len] == '\n') return p + len;
+    return NULL;
+}
+
+#ifdef KILO_SIMD_X86
+int nthBit(unsigned m, size_t k) {          // position of the k-th set bit, 1-based
+    while (--k) m &= m - 1;
+    return __builtin_ctz(m);
+}
+
+__attribute__((target("sse2")))
+size_t nlCountSSE2(const char *p, size_t len, size_t *done) { // whole vectors only, *done bytes
+    const __m128i nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    size_t i = 0, lanes[2];
+    while (i + 16 <= len) {                 // byte counters, folded before any can wrap
+        __m128i acc = zero;
+        size_t stop = len - i < 255 * 16 ? i + (len - i) / 16 * 16 : i + 255 * 16;
+        for (; i < stop; i += 16)           // a match compares as -1
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), nl));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(acc, zero));
+    }
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    *done = i;
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse2")))
+const char *nlScanSSE2(const char *p, size_t len, size_t k, size_t *seen) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t n = 0, i = 0, rest;
+    if (k == SIZE_MAX) n = nlCountSSE2(p, len, &i); // nothing to find: just add up
+    for (; i + 16 <= len; i += 16) {
+        unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_loadu_si128((const __m128i *)(p + i)), nl));
+        size_t c = __builtin_popcount(m);
+        if (c >= k - n) return p + i + nthBit(m, k - n);
+        n += c;
+    }
+    const char *hit = nlScanScalar(p + i, len - i, k - n, &rest);
+    if (seen && !hit) *seen = n + rest;
+    return hit;
+}
+
+__attribute__((target("avx2")))
+size_t nlCountAVX2(const char *p, size_t len, size_t *done) { // whole vectors only, *done bytes
+    const __m256i nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+    __m256i sum = zero;
+    size_t i = 0, lanes[4];
+    while (i + 32 <= len) {                 // byte counters, folded before any can wrap
+        __m256i acc = zero;
+        size_t stop = len - i < 255 * 32 ? i + (len - i) / 32 * 32 : i + 255 * 32;
+        for (; i < stop; i += 32)           // a match compares as -1
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)), nl));
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(acc, zero));
+    }
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    *done = i;
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+const char *nlScanAVX2(const char *p, size_t len, size_t k, size_t *seen) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0, i = 0, rest;
+    if (k == SIZE_MAX) n = nlCountAVX2(p, len, &i); // nothing to find: just add up
+    for (; i + 64 <= len; i += 64) {         // two vectors per step
+        unsigned lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(p + i)), nl));
+        unsigned hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(p + i + 32)), nl));
+        size_t c = __builtin_popcount(lo) + __builtin_popcount(hi);
+        if (c >= k - n) {
+            size_t clo = __builtin_popcount(lo);
+            if (clo >= k - n) return p + i + nthBit(lo, k - n);
+            return p + i + 32 + nthBit(hi, k - n - clo);
+        }
+        n += c;
+    }
+    const char *hit = nlScanScalar(p + i, len - i, k - n, &rest);
+    if (seen && !hit) *seen = n + rest;
+    return hit;
+}
+#endif
+
+const char *(*nlScan)(const char *, size_t, size_t, size_t *) = nlScanScalar;
+
+void nlScanInit(void) {                     // pick the kernel for this CPU
+#ifdef KILO_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) nlScan = nlScanAVX2;
+    else if (__builtin_cpu_supports("sse2")) nlScan = nlScanSSE2;
+#endif
+}
+
+size_t countNewlines(const char *p, size_t len) { // count '\n' bytes
+    size_t n;
+    nlScan(p, len, SIZE_MAX, &n);
+    return n;
+}
+
+/*** Substring Search ***/
+/* The first occurrence of a needle in a range. The vector kernels compare
+   every position against the needle's first and last bytes at once and
+   run memcmp only where both agree, which on real text is rarely more than
+   the true matches. As with newlines, the widest kernel the CPU supports
+   is chosen at startup. */
+const char *findScalar(const char *p, size_t len, const char *s, size_t n) {
+    const char *end = p + len;
+    if (n == 0) return p;
+    if (n > len) return NULL;
+    end -= n - 1;                           // last possible start + 1
+    while ((p = memchr(p, s[0], end - p)) != NULL) {
+        if (p[n - 1] == s[n - 1] && memcmp(p + 1, s + 1, n - 1) == 0) return p;
+        p++;
+    }
+    return NULL;
+}
+
+#ifdef KILO_SIMD_X86
+__attribute__((target("sse2")))
+const char *findSSE2(const char *p, size_t len, const char *s, size_t n) {
+    if (n < 2 || n > len) return findScalar(p, len, s, n);
+    const __m128i first = _mm_set1_epi8(s[0]), last = _mm_set1_epi8(s[n - 1]);
+    size_t i = 0;
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        unsigned m = _mm_movemask_epi8(_mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), first),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + n - 1)), last)));
+        for (; m; m &= m - 1) {
+            const char *at = p + i + __builtin_ctz(m);
+            if (memcmp(at + 1, s + 1, n - 2) == 0) return at;
+        }
+    }
+    return findScalar(p + i, len - i, s, n);
+}
+
+__attribute__((target("avx2")))
+const char *findAVX2(const char *p, size_t len, const char *s, size_t n) {
+    if (n < 2 || n > len) return findScalar(p, len, s, n);
+    const __m256i first = _mm256_set1_epi8(s[0]), last = _mm256_set1_epi8(s[n - 1]);
+    size_t i = 0;
+    for (; i + n - 1 + 64 <= len; i += 64) { // two vectors per step, one test when neither hits
+        const char *q = p + i;
+        __m256i lo = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)q), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + n - 1)), last));
+        __m256i hi = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + 32)), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(q + n + 31)), last));
+        if (_mm256_testz_si256(_mm256_or_si256(lo, hi), _mm256_or_si256(lo, hi))) continue;
+        uint64_t m = (unsigned)_mm256_movemask_epi8(lo) | (uint64_t)(unsigned)_mm256_movemask_epi8(hi) << 32;
+        for (; m; m &= m - 1) {
+            const char *at = q + __builtin_ctzll(m);
+            if (memcmp(at + 1, s + 1, n - 2) == 0) return at;
+        }
+    }
+    return findScalar(p + i, len - i, s, n);
+}
+#endif
+
+const char *(*findScan)(const char *, size_t, const char *, size_t) = findScalar;
+
+void findScanInit(void) {                   // pick the kernel for this CPU
+#ifdef KILO_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) findScan = findAVX2;
+    else if (__builtin_cpu_supports("sse2")) findScan = findSSE2;
+#endif
+}
+
+/*** Regex ***/
+/* Patterns are parsed into a small syntax tree and compiled twice into
+   Thompson NFAs, forwards and reversed. Matching is per line and
+   leftmost-longest. ^ and $ are the pseudo-bytes RE_BOL and RE_EOL, fed at
+   the two ends of a line. Scans run a DFA whose states are sets of NFA
+   nodes, built lazily: a state's transition for a byte class is filled in
+   the first time it is taken. A DFA that outgrows RE_DFA_MEM is flushed and
+   rebuilt. If it keeps being flushed, as with (a|b)*a(a|b){20}, the scan
+   simulates the NFA instead. Either way the time stays linear in the text.
+   Compiled patterns are cached by their text, so retyping a query or
+   redrawing its matches reuses the automata built so far. */
+#define RE_MAX_NODES 16384                  // NFA size limit, repeats count every copy
+#define RE_MAX_REPEAT 1000                  // largest {n}
+#define RE_DFA_MEM (1 << 20)                // transition bytes per DFA before a flush
+#define RE_FLUSHES 8                        // flushes in one scan before simulating the NFA
+#define RE_CACHE 8                          // compiled patterns kept
+
+enum reAstOp { RA_EMPTY, RA_CLASS, RA_BOL, RA_EOL, RA_CAT, RA_ALT, RA_REPEAT };
+enum reNodeOp { RN_CLASS, RN_BOL, RN_EOL, RN_SPLIT, RN_MATCH };
+enum reKind { RE_FORWARD, RE_ANCHORED, RE_REVERSE }; // what a DFA runs: unanchored, anchored, reversed
+
+struct reAst {                              // syntax tree node
+    int op;                                 // RA_*
+    int a, b;                               // children
+    int min, max;                           // RA_REPEAT bounds, max -1 for no limit
+    int cls;                                // RA_CLASS byte set
+};
+
+struct reNode {                             // NFA node
+    int op;                                 // RN_*
+    int out, out1;                          // next nodes, out1 for RN_SPLIT only
+    int cls;                                // RN_CLASS byte set
+};
+
+struct reDfa {                              // lazily built DFA over NFA node sets
+    int *trans;                             // maxstates * nsym: -1 unknown, t * nsym, or -2 - t * nsym if t accepts
+    unsigned char *accept;                  // state contains the match node
+    int *setstart;                          // state i is sets[setstart[i] .. setstart[i + 1])
+    int *sets;
+    int setscap;
+    int numstates, maxstates;
+    int *hash;                              // state + 1 by set hash, 0 for empty slots
+    int hashcap;
+    int start;                              // state of the start set, -1 until made
+    int flushes;                            // in the current scan
+};
+
+struct regex {
+    char *pattern;                          // the cache key
+    size_t patlen;
+    char *lit;                              // longest byte string every match contains
+    size_t litlen;
+    struct reNode *nodes;
+    int numnodes, capnodes;
+    int start[2];                           // entry node, forwards and reversed
+    int match;                              // the node both reach at the end
+    unsigned char (*classes)[32];           // byte sets, 256 bits each
+    int numclasses;
+    unsigned char byteclass[256];           // byte to symbol; RE_BOL and RE_EOL follow
+    int rep[256];                           // a byte of each symbol
+    int nsym;                               // byte classes plus two
+    struct reDfa dfa[3];                    // by reKind
+    int *mark, gen;                         // mark[n] == gen: n is in the set being built
+    int *stack;                             // closure work list
+    int *tmp, tmpn;                         // set being built
+    unsigned long used;                     // cache clock of the last use
+};
+
+#define RE_BOL(re) ((re)->nsym - 2)         // start of line, before its first byte
+#define RE_EOL(re) ((re)->nsym - 1)         // end of line, where its '\n' is
+
+struct reParser {
+    const char *p, *end;                    // pattern left to parse
+    struct reAst *ast;
+    int numast;
+    unsigned char (*classes)[32];
+    int numclasses;
+    const char *error;
+};
+
+struct reRun {                              // one pass through a DFA, or the NFA
+    struct regex *re;
+    int kind;                               // reKind
+    int s;                                  // DFA state, -1 while simulating the NFA
+    int *set, n;                            // NFA nodes while simulating
+    int accept;                             // the last step ended a match
+    int dead;                               // no match can continue
+};
+
+const char *reError;                        // why the last compile failed
+struct regex *reCache[RE_CACHE];            // compiled patterns, most recent by used
+unsigned long reClock;
+
+int reAstNew(struct reParser *ps, int op, int a, int b) {
+    struct reAst *n = &ps->ast[ps->numast];
+    n->op = op;
+    n->a = a;
+    n->b = b;
+    n->min = n->max = n->cls = 0;
+    return ps->numast++;
+}
+
+int reClassNew(struct reParser *ps) {       // empty byte set
+    memset(ps->classes[ps->numclasses], 0, 32);
+    return ps->numclasses++;
+}
+
+void reClassAdd(unsigned char *set, int lo, int hi) { // bytes lo..hi, never '\n'
+    for (; lo <= hi; lo++) if (lo != '\n') set[lo >> 3] |= 1 << (lo & 7);
+}
+
+int reClassEscape(unsigned char *set, int c) { // \d \w \s or their negations, 0 if c is none
+    unsigned char t[32] = {0};
+    int i, neg = isupper(c);
+    switch (tolower(c)) {
+        case 'd': reClassAdd(t, '0', '9'); break;
+        case 'w':
+            reClassAdd(t, '0', '9');
+            reClassAdd(t, 'a', 'z');
+            reClassAdd(t, 'A', 'Z');
+            reClassAdd(t, '_', '_');
+            break;
+        case 's':
+            reClassAdd(t, '\t', '\r');
+            reClassAdd(t, ' ', ' ');
+            break;
+        default: return 0;
+    }
+    for (i = 0; i < 32; i++) set[i] |= neg ? ~t[i] : t[i];
+    set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    return 1;
+}
+
+int reEscapeByte(int c) {                   // \t and friends, else the byte itself
+    return c == 't' ? '\t' : c == 'r' ? '\r' : c == 'f' ? '\f' : c == 'v' ? '\v' : c;
+}
+
+int reParseClass(struct reParser *ps) {     // after '[': a bracket expression's byte set
+    int cls = reClassNew(ps), neg = 0, i;
+    unsigned char *set = ps->classes[cls];
+    if (ps->p < ps->end && *ps->p == '^') {
+        neg = 1;
+        ps->p++;
+    }
+    const char *first = ps->p;
+    while (ps->p < ps->end && (*ps->p != ']' || ps->p == first)) { // a leading ] is literal
+        int lo = (unsigned char)*ps->p++, hi;
+        if (lo == '\\' && ps->p < ps->end) {
+            lo = (unsigned char)*ps->p++;
+            if (reClassEscape(set, lo)) continue;
+            lo = reEscapeByte(lo);
+        }
+        hi = lo;
+        if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') { // a range
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (hi == '\\' && ps->p < ps->end) hi = reEscapeByte((unsigned char)*ps->p++);
+            if (hi < lo) {
+                ps->error = "bad range";
+                return -1;
+            }
+        }
+        reClassAdd(set, lo, hi);
+    }
+    if (ps->p == ps->end) {
+        ps->error = "missing ]";
+        return -1;
+    }
+    ps->p++;
+    if (neg) {
+        for (i = 0; i < 32; i++) set[i] = ~set[i];
+        set['\n' >> 3] &= ~(1 << ('\n' & 7));
+    }
+    return cls;
+}
+
+int reParseCount(struct reParser *ps, int *n) { // digits at p, capped past RE_MAX_REPEAT
+    if (ps->p == ps->end || !isdigit((unsigned char)*ps->p)) return 0;
+    for (*n = 0; ps->p < ps->end && isdigit((unsigned char)*ps->p); ps->p++)
+        if (*n <= RE_MAX_REPEAT) *n = *n * 10 + *ps->p - '0';
+    return 1;
+}
+
+int reParseRepeat(struct reParser *ps, int *min, int *max) { // quantifier at p, 0 if none, -1 if bad
+    const char *p = ps->p;
+    if (p == ps->end) return 0;
+    if (*p == '*' || *p == '+' || *p == '?') {
+        *min = *p == '+';
+        *max = *p == '?' ? 1 : -1;
+        ps->p++;
+        return 1;
+    }
+    if (*p != '{' || p + 1 == ps->end || !isdigit((unsigned char)p[1])) return 0; // a literal {
+    ps->p++;
+    reParseCount(ps, min);
+    *max = *min;
+    if (ps->p < ps->end && *ps->p == ',') {
+        ps->p++;
+        if (!reParseCount(ps, max)) *max = -1;
+    }
+    if (ps->p == ps->end || *ps->p != '}' || *min > RE_MAX_REPEAT || *max > RE_MAX_REPEAT ||
+        (*max >= 0 && *max < *min)) {
+        ps->error = "bad {}";
+        return -1;
+    }
+    ps->p++;
+    return 1;
+}
+
+int reParseAlt(struct reParser *ps, int depth) { // alternatives up to ')' or the end
+    int alt = -1, min, max, q;
+    while (1) {
+        int cat = -1;                       // this alternative so far
+        while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+            int c = (unsigned char)*ps->p++, atom, cls;
+            if (c == '(') {
+                if ((atom = reParseAlt(ps, depth + 1)) < 0) return -1;
+                if (ps->p == ps->end) {
+                    ps->error = "missing )";
+                    return -1;
+                }
+                ps->p++;
+            } else if (c == '^' || c == '$') {
+                atom = reAstNew(ps, c == '^' ? RA_BOL : RA_EOL, 0, 0);
+            } else if (c == '*' || c == '+' || c == '?') {
+                ps->error = "nothing to repeat";
+                return -1;
+            } else {                        // one byte out of a set
+                if (c == '[') {
+                    if ((cls = reParseClass(ps)) < 0) return -1;
+                } else {
+                    unsigned char *set = ps->classes[cls = reClassNew(ps)];
+                    if (c == '.') reClassAdd(set, 0, 255);
+                    else if (c == '\\' && ps->p < ps->end) {
+                        c = (unsigned char)*ps->p++;
+                        if (!reClassEscape(set, c)) reClassAdd(set, reEscapeByte(c), reEscapeByte(c));
+                    } else reClassAdd(set, c, c);
+                }
+                atom = reAstNew(ps, RA_CLASS, 0, 0);
+                ps->ast[atom].cls = cls;
+            }
+            while ((q = reParseRepeat(ps, &min, &max)) > 0) {
+                atom = reAstNew(ps, RA_REPEAT, atom, 0);
+                ps->ast[atom].min = min;
+                ps->ast[atom].max = max;
+            }
+            if (q < 0) return -1;
+            cat = cat < 0 ? atom : reAstNew(ps, RA_CAT, cat, atom);
+        }
+        if (cat < 0) cat = reAstNew(ps, RA_EMPTY, 0, 0);
+        alt = alt < 0 ? cat : reAstNew(ps, RA_ALT, alt, cat);
+        if (ps->p == ps->end || *ps->p != '|') break;
+        ps->p++;
+    }
+    if (depth == 0 && ps->p < ps->end) {
+        ps->error = "unmatched )";
+        return -1;
+    }
+    return alt;
+}
+
+void reLiteral(const struct reParser *ps, int i, int *seq, int *n) { // the pattern's top-level concatenation
+    const struct reAst *a = &ps->ast[i];    // as bytes, -1 for anything else
+    int b, c = -1;
+    if (a->op == RA_CAT) {                  // groups without | too
+        reLiteral(ps, a->a, seq, n);
+        reLiteral(ps, a->b, seq, n);
+        return;
+    }
+    if (a->op == RA_EMPTY) return;
+    if (a->op == RA_CLASS)
+        for (b = 0; b < 256; b++)
+            if ((ps->classes[a->cls][b >> 3] >> (b & 7)) & 1) c = c == -1 ? b : -2;
+    seq[(*n)++] = c < 0 ? -1 : c;
+}
+
+int reNodeNew(struct regex *re, int op, int out, int out1, int cls) { // -1 past RE_MAX_NODES
+    if (re->numnodes == RE_MAX_NODES) return -1;
+    if (re->numnodes == re->capnodes) {
+        re->capnodes = re->capnodes ? re->capnodes * 2 : 64;
+        re->nodes = realloc(re->nodes, sizeof(struct reNode) * re->capnodes);
+        if (re->nodes == NULL) die("realloc");
+    }
+    struct reNode *n = &re->nodes[re->numnodes];
+    n->op = op;
+    n->out = out;
+    n->out1 = out1;
+    n->cls = cls;
+    return re->numnodes++;
+}
+
+int reCompile(struct regex *re, const struct reAst *ast, int i, int next, int rev) { // NFA for ast[i], then next
+    const struct reAst *a = &ast[i];
+    int x, y, k, last = next;
+    switch (a->op) {
+        case RA_EMPTY: return next;
+        case RA_CLASS: return reNodeNew(re, RN_CLASS, next, -1, a->cls);
+        case RA_BOL: return reNodeNew(re, RN_BOL, next, -1, 0);
+        case RA_EOL: return reNodeNew(re, RN_EOL, next, -1, 0);
+        case RA_CAT:                        // reversed, the right side comes first
+            if ((x = reCompile(re, ast, rev ? a->a : a->b, next, rev)) < 0) return -1;
+            return reCompile(re, ast, rev ? a->b : a->a, x, rev);
+        case RA_ALT:
+            if ((x = reCompile(re, ast, a->a, next, rev)) < 0) return -1;
+            if ((y = reCompile(re, ast, a->b, next, rev)) < 0) return -1;
+            return reNodeNew(re, RN_SPLIT, x, y, 0);
+        case RA_REPEAT:
+            if (a->max < 0) {               // loop back through a split
+                if ((x = reNodeNew(re, RN_SPLIT, -1, next, 0)) < 0) return -1;
+                if ((y = reCompile(re, ast, a->a, x, rev)) < 0) return -1;
+                re->nodes[x].out = y;
+                next = x;
+            }
+            for (k = a->min; k < a->max; k++) { // optional copies, each inside the one before
+                if ((y = reCompile(re, ast, a->a, next, rev)) < 0) return -1;
+                if ((next = reNodeNew(re, RN_SPLIT, y, last, 0)) < 0) return -1;
+            }
+            for (k = 0; k < a->min; k++)
+                if ((next = reCompile(re, ast, a->a, next, rev)) < 0) return -1;
+            return next;
+    }
+    return -1;
+}
+
+void reFree(struct regex *re) {
+    int k;
+    if (re == NULL) return;
+    for (k = 0; k < 3; k++) {
+        free(re->dfa[k].trans);
+        free(re->dfa[k].accept);
+        free(re->dfa[k].setstart);
+        free(re->dfa[k].sets);
+        free(re->dfa[k].hash);
+    }
+    free(re->pattern);
+    free(re->lit);
+    free(re->nodes);
+    free(re->classes);
+    free(re->mark);
+    free(re->stack);
+    free(re->tmp);
+    free(re);
+}
+
+void reDfaFlush(struct reDfa *d) {          // forget every state
+    d->numstates = 0;
+    d->setstart[0] = 0;
+    d->start = -1;
+    memset(d->hash, 0, sizeof(int) * d->hashcap);
+}
+
+void reDfaInit(struct regex *re, struct reDfa *d) { // size the tables, before the first scan
+    d->maxstates = RE_DFA_MEM / (int)sizeof(int) / re->nsym;
+    if (d->maxstates < 16) d->maxstates = 16;
+    for (d->hashcap = 64; d->hashcap < 2 * d->maxstates; d->hashcap *= 2);
+    d->setscap = RE_DFA_MEM / sizeof(int);
+    d->trans = malloc(sizeof(int) * d->maxstates * re->nsym);
+    d->accept = malloc(d->maxstates);
+    d->setstart = malloc(sizeof(int) * (d->maxstates + 1));
+    d->sets = malloc(sizeof(int) * d->setscap);
+    d->hash = malloc(sizeof(int) * d->hashcap);
+    if (!d->trans || !d->accept || !d->setstart || !d->sets || !d->hash) die("malloc");
+    reDfaFlush(d);
+}
+
+struct regex *reNew(const char *pattern, size_t len) { // compile, NULL and reError if it can't be
+    struct reParser ps = {pattern, pattern + len, NULL, 0, NULL, 0, NULL};
+    struct regex *re = calloc(1, sizeof(struct regex));
+    unsigned char edge[256] = {0};
+    int root, b, k, *seq, n = 0, run, best = 0, end = 0;
+    if (re == NULL) die("calloc");
+    ps.ast = malloc(sizeof(struct reAst) * (4 * len + 4)); // atom, repeat, join and branch per byte
+    ps.classes = re->classes = malloc(32 * (len + 1));
+    re->pattern = malloc(len + 1);
+    if (ps.ast == NULL || ps.classes == NULL || re->pattern == NULL) die("malloc");
+    memcpy(re->pattern, pattern, len);
+    re->patlen = len;
+
+    if ((root = reParseAlt(&ps, 0)) < 0) {
+        reError = ps.error;
+        free(ps.ast);
+        reFree(re);
+        return NULL;
+    }
+    re->numclasses = ps.numclasses;
+    seq = malloc(sizeof(int) * ps.numast);
+    re->lit = malloc(len + 1);
+    if (seq == NULL || re->lit == NULL) die("malloc");
+    reLiteral(&ps, root, seq, &n);
+    for (k = run = 0; k < n; k++) {         // the longest run of single bytes
+        run = seq[k] < 0 ? 0 : run + 1;
+        if (run > best) {
+            best = run;
+            end = k + 1;
+        }
+    }
+    for (k = 0; k < best; k++) re->lit[k] = seq[end - best + k];
+    re->litlen = best;
+    free(seq);
+    re->match = reNodeNew(re, RN_MATCH, -1, -1, 0);
+    re->start[0] = reCompile(re, ps.ast, root, re->match, 0);
+    re->start[1] = re->start[0] < 0 ? -1 : reCompile(re, ps.ast, root, re->match, 1);
+    free(ps.ast);
+    if (re->start[1] < 0) {
+        reError = "pattern too big";
+        reFree(re);
+        return NULL;
+    }
+
+    edge['\n'] = edge['\n' + 1] = 1;        // '\n' is a symbol of its own
+    for (k = 0; k < re->numclasses; k++)    // a new symbol wherever any set changes
+        for (b = 1; b < 256; b++)
+            if (((re->classes[k][b >> 3] >> (b & 7)) ^ (re->classes[k][(b - 1) >> 3] >> ((b - 1) & 7))) & 1)
+                edge[b] = 1;
+    for (b = 0; b < 256; b++) {
+        re->byteclass[b] = b ? re->byteclass[b - 1] + edge[b] : 0;
+        if (b == 0 || edge[b]) re->rep[re->byteclass[b]] = b;
+    }
+    re->nsym = re->byteclass[255] + 3;
+    re->mark = calloc(re->numnodes, sizeof(int));
+    re->stack = malloc(sizeof(int) * (2 * re->numnodes + 2));
+    re->tmp = malloc(sizeof(int) * re->numnodes);
+    if (re->mark == NULL || re->stack == NULL || re->tmp == NULL) die("malloc");
+    for (k = 0; k < 3; k++) re->dfa[k].start = -1;
+    return re;
+}
+
+struct regex *reGet(const char *pattern, size_t len) { // compiled pattern from the cache
+    int i, k, victim = 0;
+    for (i = 0; i < RE_CACHE; i++) {
+        struct regex *re = reCache[i];
+        if (re && re->patlen == len && memcmp(re->pattern, pattern, len) == 0) {
+            re->used = ++reClock;
+            return re;
+        }
+        if (re == NULL || (reCache[victim] && re->used < reCache[victim]->used)) victim = i;
+    }
+    struct regex *re = reNew(pattern, len);
+    if (re == NULL) return NULL;
+    for (k = 0; k < 3; k++) reDfaInit(re, &re->dfa[k]); // drawing its matches must not allocate
+    reFree(reCache[victim]);                // least recently used
+    reCache[victim] = re;
+    re->used = ++reClock;
+    return re;
+}
+
+void reAdd(struct regex *re, int *set, int *n, int node) { // node and what it reaches without input
+    int sp = 0;
+    re->stack[sp++] = node;
+    while (sp) {
+        node = re->stack[--sp];
+        if (re->mark[node] == re->gen) continue;
+        re->mark[node] = re->gen;
+        if (re->nodes[node].op == RN_SPLIT) {
+            re->stack[sp++] = re->nodes[node].out1;
+            re->stack[sp++] = re->nodes[node].out;
+        } else {
+            set[(*n)++] = node;
+        }
+    }
+}
+
+int reCmpInt(const void *a, const void *b) { return *(const int *)a - *(const int *)b; }
+
+int reStart(struct regex *re, int kind, int *set) { // start set, sorted
+    int n = 0;
+    re->gen++;
+    reAdd(re, set, &n, re->start[kind == RE_REVERSE]);
+    qsort(set, n, sizeof(int), reCmpInt);
+    return n;
+}
+
+int reStep(struct regex *re, int kind, const int *in, int n, int sym, int *out) { // next set, sorted
+    int i, m = 0, bol = RE_BOL(re);
+    re->gen++;
+    if (sym >= bol) {                       // ^ or $: every node stays, and each one
+        int op = sym == bol ? RN_BOL : RN_EOL; // waiting on it moves on, ^^ as well
+        for (i = 0; i < n; i++) reAdd(re, out, &m, in[i]);
+        for (i = 0; i < m; i++) if (re->nodes[out[i]].op == op) reAdd(re, out, &m, re->nodes[out[i]].out);
+    } else {
+        for (i = 0; i < n; i++) {
+            const struct reNode *nd = &re->nodes[in[i]];
+            if (nd->op == RN_CLASS && (re->classes[nd->cls][re->rep[sym] >> 3] >> (re->rep[sym] & 7)) & 1)
+                reAdd(re, out, &m, nd->out);
+        }
+    }
+    if (kind != RE_ANCHORED) reAdd(re, out, &m, re->start[kind == RE_REVERSE]); // a match may begin anywhere
+    qsort(out, m, sizeof(int), reCmpInt);
+    return m;
+}
+
+int reDfaState(struct regex *re, struct reDfa *d, const int *set, int n) { // state for a set, -1 when full
+    unsigned h = 2166136261u;
+    int i;
+    for (i = 0; i < n; i++) h = (h ^ set[i]) * 16777619u;
+    for (h &= d->hashcap - 1; d->hash[h]; h = (h + 1) & (d->hashcap - 1)) {
+        int s = d->hash[h] - 1, len = d->setstart[s + 1] - d->setstart[s];
+        if (len == n && memcmp(d->sets + d->setstart[s], set, sizeof(int) * n) == 0) return s;
+    }
+    if (d->numstates == d->maxstates || d->setstart[d->numstates] + n > d->setscap) return -1;
+    int s = d->numstates++;
+    memcpy(d->sets + d->setstart[s], set, sizeof(int) * n);
+    d->setstart[s + 1] = d->setstart[s] + n;
+    d->accept[s] = re->mark[re->match] == re->gen; // set was just built
+    memset(d->trans + (size_t)s * re->nsym, 0xff, sizeof(int) * re->nsym);
+    d->hash[h] = s + 1;
+    return s;
+}
+
+int reDfaNext(struct regex *re, int kind, int s, int sym) { // fill in a transition, -1 to give up
+    struct reDfa *d = &re->dfa[kind];
+    re->tmpn = reStep(re, kind, d->sets + d->setstart[s], d->setstart[s + 1] - d->setstart[s], sym, re->tmp);
+    int t = reDfaState(re, d, re->tmp, re->tmpn);
+    if (t >= 0) {
+        d->trans[(size_t)s * re->nsym + sym] = d->accept[t] ? -2 - t * re->nsym : t * re->nsym;
+        return t;
+    }
+    if (++d->flushes > RE_FLUSHES) return -1; // thrashing: tmp holds the set to go on with
+    reDfaFlush(d);
+    return reDfaState(re, d, re->tmp, re->tmpn);
+}
+
+void reRunInit(struct reRun *r, struct regex *re, int kind) { // at the start set
+    struct reDfa *d = &re->dfa[kind];
+    r->re = re;
+    r->kind = kind;
+    r->set = NULL;
+    r->dead = 0;
+    if (d->trans == NULL) reDfaInit(re, d);
+    if (d->start < 0) {
+        int n = reStart(re, kind, re->tmp);
+        if ((d->start = reDfaState(re, d, re->tmp, n)) < 0) {
+            d->flushes++;
+            reDfaFlush(d);
+            d->start = reDfaState(re, d, re->tmp, n);
+        }
+    }
+    r->s = d->start;
+    r->accept = d->accept[r->s];
+}
+
+void reRunStep(struct reRun *r, int sym) {  // feed one symbol
+    struct regex *re = r->re;
+    struct reDfa *d = &re->dfa[r->kind];
+    if (r->s >= 0) {
+        int t = d->trans[(size_t)r->s * re->nsym + sym];
+        if (t != -1) t = (t < -1 ? -2 - t : t) / re->nsym;
+        else if ((t = reDfaNext(re, r->kind, r->s, sym)) < 0) { // simulate the NFA from here
+            r->set = malloc(sizeof(int) * re->numnodes);
+            if (r->set == NULL) die("malloc");
+            memcpy(r->set, re->tmp, sizeof(int) * re->tmpn);
+            r->n = re->tmpn;
+            r->s = -1;
+            r->accept = re->mark[re->match] == re->gen;
+            r->dead = r->n == 0;
+            return;
+        }
+        r->s = t;
+        r->accept = d->accept[t];
+        r->dead = d->setstart[t + 1] == d->setstart[t];
+        return;
+    }
+    r->n = reStep(re, r->kind, r->set, r->n, sym, re->tmp);
+    memcpy(r->set, re->tmp, sizeof(int) * r->n);
+    r->accept = re->mark[re->match] == re->gen;
+    r->dead = r->n == 0;
+}
+
+size_t reRunFast(struct reRun *r, const char *p, size_t n) { // bytes stepped without a match or a new state
+    if (r->s < 0) return 0;                 // unanchored runs only: their states never die
+    const int *trans = r->re->dfa[r->kind].trans;
+    const unsigned char *bc = r->re->byteclass;
+    int nsym = r->re->nsym, s = r->s * nsym, t;
+    size_t i = 0;
+    while (i < n && (t = trans[s + bc[(unsigned char)p[i]]]) >= 0) {
+        s = t;
+        i++;
+    }
+    r->s = s / nsym;
+    if (i) r->accept = 0;
+    return i;
+}
+
+void reRunFree(struct reRun *r) { free(r->set); }
+
+int reRunNewline(struct reRun *r) {         // '\n' in a forward run: 1 if $ ends a match, else at the next line
+    struct regex *re = r->re;
+    struct reDfa *d = &re->dfa[RE_FORWARD];
+    int s = r->s, flushes = d->flushes;
+    reRunStep(r, RE_EOL(re));
+    if (r->accept) return 1;
+    reRunFree(r);
+    reRunInit(r, re, RE_FORWARD);
+    reRunStep(r, RE_BOL(re));
+    if (s >= 0 && r->s >= 0 && d->flushes == flushes) { // s is still the same set: reRunFast goes on through
+        int t = r->s * re->nsym;
+        d->trans[(size_t)s * re->nsym + re->byteclass['\n']] = r->accept ? -2 - t : t;
+    }
+    return 0;
+}
+
+int reSearch(struct regex *re, const char *p, size_t len, int bol, int eol, size_t *start, size_t *end) {
+    struct reRun r;                         // leftmost-longest match in one line, 0 if none
+    size_t i, s = SIZE_MAX, e = SIZE_MAX;
+    re->dfa[RE_REVERSE].flushes = re->dfa[RE_ANCHORED].flushes = 0;
+    reRunInit(&r, re, RE_REVERSE);          // backwards: every start of a match
+    if (eol) reRunStep(&r, RE_EOL(re));
+    if (r.accept) s = len;
+    for (i = len; i > 0; i--) {
+        reRunStep(&r, re->byteclass[(unsigned char)p[i - 1]]);
+        if (r.accept) s = i - 1;
+    }
+    if (bol) {
+        reRunStep(&r, RE_BOL(re));
+        if (r.accept) s = 0;
+    }
+    reRunFree(&r);
+    if (s == SIZE_MAX) return 0;
+
+    reRunInit(&r, re, RE_ANCHORED);         // forwards from the leftmost start: the longest end
+    if (bol && s == 0) reRunStep(&r, RE_BOL(re));
+    if (r.accept) e = s;
+    for (i = s; i < len && !r.dead; i++) {
+        reRunStep(&r, re->byteclass[(unsigned char)p[i]]);
+        if (r.accept) e = i + 1;
+    }
+    if (eol && i == len && !r.dead) {
+        reRunStep(&r, RE_EOL(re));
+        if (r.accept) e = len;
+    }
+    reRunFree(&r);
+    *start = s;
+    *end = e;
+    return e != SIZE_MAX;
+}
+
+/*** Line Index ***/
+/* Cumulative newline counts per LI_BLOCK of the original buffer. Any line
+   start or range count costs a binary search plus a scan of at most one
+   block, and the index stays valid under edits because the original
+   buffer never changes.
+
+   Only the first LI_SYNC_BLOCKS are indexed before the first paint; a
+   background thread does the rest front to back and publishes how far it
+   got through 'indexed'. Readers load that with acquire semantics and never
+   lock; lookups past it wait for the indexer to catch up. */
+#define LI_BLOCK (64 * 1024)                // bytes per index block
+#define LI_SYNC_BLOCKS 16                   // blocks indexed before first paint
+
+size_t liIndexed(const struct lineIndex *li) { // bytes the indexer has published
+    return __atomic_load_n(&li->indexed, __ATOMIC_ACQUIRE);
+}
+
+int liStep(struct lineIndex *li, size_t b) { // index block b, 0 when done
+    if (b >= li->numblocks) return 0;
+    size_t off = b * LI_BLOCK, n = li->len - off < LI_BLOCK ? li->len - off : LI_BLOCK;
+    li->cum[b + 1] = li->cum[b] + countNewlines(li->base + off, n);
+    __atomic_store_n(&li->indexed, off + n, __ATOMIC_RELEASE); // publish after cum[b + 1]
+    return 1;
+}
+
+void *liWorker(void *arg) {                 // background indexer thread
+    struct lineIndex *li = arg;
+    size_t b = liIndexed(li) / LI_BLOCK;
+    int shown = -1;
+    while (!__atomic_load_n(&li->stop, __ATOMIC_RELAXED) && liStep(li, b)) {
+        int pct = (int)(liIndexed(li) * 100 / li->len);
+        if (pct != shown && li->notifyfd != -1) { // wake the main loop once per percent
+            if (write(li->notifyfd, "i", 1) == -1 && errno != EAGAIN)
+                li->notifyfd = -1;          // keep indexing, liWait() needs it; just stop waking
+            shown = pct;
+        }
+        b++;
+    }
+    return NULL;
+}
+
+void liStart(struct lineIndex *li, const char *p, size_t len, int notifyfd) { // index a buffer lazily
+    size_t b;
+    memset(li, 0, sizeof(*li));
+    li->base = p;
+    li->len = len;
+    li->notifyfd = notifyfd;
+    li->numblocks = (len + LI_BLOCK - 1) / LI_BLOCK;
+    li->cum = malloc(sizeof(size_t) * (li->numblocks + 1));
+    if (li->cum == NULL) die("malloc");
+    li->cum[0] = 0;
+    for (b = 0; b < LI_SYNC_BLOCKS && liStep(li, b); b++); // the first screens
+    if (b < li->numblocks && pthread_create(&li->thread, NULL, liWorker, li) == 0)
+        li->running = 1;
+    else
+        while (liStep(li, b)) b++;          // no thread: finish synchronously
+}
+
+void liFree(struct lineIndex *li) {
+    if (li->running) {                      // stop the indexer before freeing
+        __atomic_store_n(&li->stop, 1, __ATOMIC_RELAXED);
+        pthread_join(li->thread, NULL);
+    }
+    free(li->cum);
+    memset(li, 0, sizeof(*li));
+}
+
+void liWait(const struct lineIndex *li, size_t done) { // block until past done
+    struct timespec ts = {0, 200000};
+    while (liIndexed(li) == done) nanosleep(&ts, NULL);
+}
+
+int liProgress(const struct lineIndex *li) { // percent indexed
+    return li->len ? (int)(liIndexed(li) * 100 / li->len) : 100;
+}
+
+size_t liPrefix(const struct lineIndex *li, const char *base, size_t off) { // newlines before off
+    size_t b = off / LI_BLOCK;
+    return li->cum[b] + countNewlines(base + b * LI_BLOCK, off - b * LI_BLOCK);
+}
+
+size_t liFind(const struct lineIndex *li, const char *base, size_t target) { // offset of newline #target
+    size_t done = liIndexed(li);
+    size_t lo = 0, hi = (done + LI_BLOCK - 1) / LI_BLOCK; // search published blocks only
+    while (lo < hi) {                       // first block whose end count reaches target
+        size_t mid = lo + (hi - lo) / 2;
+        if (li->cum[mid + 1] < target) lo = mid + 1;
+        else hi = mid;
+    }
+    size_t off = lo * LI_BLOCK, n = done - off < LI_BLOCK ? done - off : LI_BLOCK;
+    return nlScan(base + off, n, target - li->cum[lo], NULL) - base;
+}
+
+/*** Piece Table ***/
+/* The document is the original file plus an append-only add buffer. Edits
+   never move text: they only split, trim or insert pieces that point into
+   one of the two buffers. */
+#define PT_BLOCK_MIN (64 * 1024)            // first add block size
+#define PT_BLOCK_MAX (64 * 1024 * 1024)     // add blocks stop doubling here
+#define PT_NLUNKNOWN ((size_t)-1)           // piece newlines not counted yet
+
+int ptIndexed(struct pieceTable *pt, const char *p, size_t len) { // covered by the line index
+    return pt->idx.cum && p >= pt->orig && p + len <= pt->orig + liIndexed(&pt->idx);
+}
+
+size_t ptCount(struct pieceTable *pt, const char *p, size_t len) { // newlines in a range
+    if (!ptIndexed(pt, p, len)) return countNewlines(p, len);
+    size_t off = p - pt->orig;
+    return liPrefix(&pt->idx, pt->orig, off + len) - liPrefix(&pt->idx, pt->orig, off);
+}
+
+const char *ptFind(struct pieceTable *pt, const char *p, size_t len, size_t k) { // k-th newline
+    if (!ptIndexed(pt, p, len)) return nlScan(p, len, k, NULL);
+    return pt->orig + liFind(&pt->idx, pt->orig, liPrefix(&pt->idx, pt->orig, p - pt->orig) + k);
+}
+
+void ptInit(struct pieceTable *pt, const char *orig, size_t len, int notifyfd) { // wrap original text
+    memset(pt, 0, sizeof(*pt));
+    pt->orig = orig;
+    pt->origlen = len;
+    pt->len = len;
+    if (len == 0) return;                   // empty document has no pieces
+    liStart(&pt->idx, orig, len, notifyfd); // notifyfd hears about indexing progress
+    pt->pieces = malloc(sizeof(struct piece) * 16);
+    if (pt->pieces == NULL) die("malloc");
+    pt->cappieces = 16;
+    pt->pieces[0] = (struct piece){orig, len, PT_NLUNKNOWN}; // counted once indexed
+    pt->numpieces = 1;
+}
+
+void ptFree(struct pieceTable *pt) {        // release pieces and add buffer
+    int j;
+    for (j = 0; j < pt->numblocks; j++) free(pt->blocks[j].b);
+    free(pt->blocks);
+    free(pt->pieces);
+    liFree(&pt->idx);
+    memset(pt, 0, sizeof(*pt));
+}
+
+void ptReserve(struct pieceTable *pt, int n) { // room for n more pieces
+    if (pt->numpieces + n <= pt->cappieces) return;
+    int cap = pt->cappieces ? pt->cappieces * 2 : 16;
+    while (cap < pt->numpieces + n) cap *= 2;
+    struct piece *new = realloc(pt->pieces, sizeof(struct piece) * cap);
+    if (new == NULL) die("realloc");
+    pt->pieces = new;
+    pt->cappieces = cap;
+}
+
+const char *ptAddText(struct pieceTable *pt, const char *s, size_t len) { // copy into add buffer
+    struct addBlock *blk = pt->numblocks ? &pt->blocks[pt->numblocks - 1] : NULL;
+    if (blk == NULL || blk->cap - blk->len < len) { // current block full: start a new one
+        size_t cap = blk ? blk->cap * 2 : PT_BLOCK_MIN;
+        if (cap > PT_BLOCK_MAX) cap = PT_BLOCK_MAX;
+        if (cap < len) cap = len;
+        struct addBlock *new = realloc(pt->blocks, sizeof(struct addBlock) * (pt->numblocks + 1));
+        if (new == NULL) die("realloc");
+        pt->blocks = new;
+        blk = &pt->blocks[pt->numblocks++];
+        blk->b = malloc(cap);
+        if (blk->b == NULL) die("malloc");
+        blk->len = 0;
+        blk->cap = cap;
+    }
+    char *dst = blk->b + blk->len;
+    memcpy(dst, s, len);
+    blk->len += len;
+    return dst;
+}
+
+int ptLocate(struct pieceTable *pt, size_t pos, size_t *start) { // piece holding pos
+    int i = 0;
+    size_t s = 0;
+    if (pt->hint < pt->numpieces && pt->hintpos <= pos) { // resume from last lookup
+        i = pt->hint;
+        s = pt->hintpos;
+    }
+    while (i < pt->numpieces && s + pt->pieces[i].len <= pos) s += pt->pieces[i++].len;
+    pt->hint = i;
+    pt->hintpos = s;
+    *start = s;
+    return i;                               // numpieces when pos == document length
+}
+
+void ptSplit(struct pieceTable *pt, int i, size_t off) { // cut piece i at off
+    ptReserve(pt, 1);
+    struct piece *pc = &pt->pieces[i];
+    struct piece right = {pc->p + off, pc->len - off, PT_NLUNKNOWN};
+    if (pc->nl != PT_NLUNKNOWN) {           // uncounted pieces split into uncounted halves
+        if (off <= right.len) {             // count newlines in the smaller half
+            size_t n = ptCount(pt, pc->p, off);
+            right.nl = pc->nl - n;
+            pc->nl = n;
+        } else {
+            right.nl = ptCount(pt, right.p, right.len);
+            pc->nl -= right.nl;
+        }
+    }
+    pc->len = off;
+    memmove(&pt->pieces[i + 2], &pt->pieces[i + 1],
+            sizeof(struct piece) * (pt->numpieces - i - 1));
+    pt->pieces[i + 1] = right;
+    pt->numpieces++;
+}
+
+void ptInsert(struct pieceTable *pt, size_t pos, const char *s, size_t len) { // insert text
+    if (len == 0) return;
+    if (pos > pt->len) pos = pt->len;
+    const char *text = ptAddText(pt, s, len);
+    size_t nl = countNewlines(text, len);
+    size_t start;
+    int i = ptLocate(pt, pos, &start);
+    size_t off = pos - start;
+
+    pt->len += len;
+    if (off == 0 && i > 0) {                // typing: extend the piece that ends here
+        struct piece *prev = &pt->pieces[i - 1];
+        if (prev->p + prev->len == text && text != pt->blocks[pt->numblocks - 1].b) {
+            pt->hint = i - 1;
+            pt->hintpos = pos - prev->len;
+            prev->len += len;
+            if (prev->nl != PT_NLUNKNOWN) prev->nl += nl;
+            return;
+        }
+    }
+    if (off > 0) ptSplit(pt, i++, off);     // insert between the two halves
+    ptReserve(pt, 1);
+    memmove(&pt->pieces[i + 1], &pt->pieces[i], sizeof(struct piece) * (pt->numpieces - i));
+    pt->pieces[i] = (struct piece){text, len, nl};
+    pt->numpieces++;
+    pt->hint = i;
+    pt->hintpos = pos;
+}
+
+void ptDelete(struct pieceTable *pt, size_t pos, size_t len) { // remove text
+    if (pos >= pt->len) return;
+    if (len > pt->len - pos) len = pt->len - pos;
+    if (len == 0) return;
+    size_t start;
+    int i = ptLocate(pt, pos, &start);
+    if (pos > start) ptSplit(pt, i++, pos - start); // deletion starts mid-piece
+    pt->len -= len;
+
+    int first = i;
+    while (len && len >= pt->pieces[i].len) len -= pt->pieces[i++].len; // whole pieces
+    if (len) {                              // trim the front of the last piece
+        struct piece *pc = &pt->pieces[i];
+        if (pc->nl != PT_NLUNKNOWN) pc->nl -= ptCount(pt, pc->p, len);
+        pc->p += len;
+        pc->len -= len;
+    }
+    memmove(&pt->pieces[first], &pt->pieces[i], sizeof(struct piece) * (pt->numpieces - i));
+    pt->numpieces -= i - first;
+    pt->hint = first;
+    pt->hintpos = pos;
+}
+
+const char *ptSpan(struct pieceTable *pt, size_t pos, size_t *len) { // contiguous text at pos
+    size_t start;
+    int i = ptLocate(pt, pos, &start);
+    if (i == pt->numpieces) { *len = 0; return NULL; }
+    *len = pt->pieces[i].len - (pos - start);
+    return pt->pieces[i].p + (pos - start);
+}
+
+const char *ptFindUncounted(struct pieceTable *pt, struct piece *pc, size_t k) { // k-th newline
+    if (pt->idx.cum == NULL) return nlScan(pc->p, pc->len, k, &pc->nl); // no index: scan lazily
+    size_t off = pc->p - pt->orig, end = off + pc->len;
+    while (1) {                             // use what is indexed, wait for the rest
+        size_t done = liIndexed(&pt->idx);
+        if (end <= done) {                  // piece fully indexed: count it once
+            pc->nl = ptCount(pt, pc->p, pc->len);
+            return pc->nl >= k ? ptFind(pt, pc->p, pc->len, k) : NULL;
+        }
+        if (off < done) {
+            size_t before = liPrefix(&pt->idx, pt->orig, off);
+            if (liPrefix(&pt->idx, pt->orig, done) - before >= k)
+                return pt->orig + liFind(&pt->idx, pt->orig, before + k);
+        }
+        liWait(&pt->idx, done);
+    }
+}
+
+size_t ptLineStart(struct pieceTable *pt, size_t line) { // offset of a line's first byte
+    size_t pos = 0;
+    int i;
+    if (line == 0) return 0;
+    for (i = 0; i < pt->numpieces; i++) {
+        struct piece *pc = &pt->pieces[i];
+        if (pc->nl == PT_NLUNKNOWN) {
+            const char *nl = ptFindUncounted(pt, pc, line);
+            if (nl) return pos + (nl - pc->p) + 1;
+        } else if (pc->nl >= line) {
+            return pos + (ptFind(pt, pc->p, pc->len, line) - pc->p) + 1;
+        }
+        line -= pc->nl;
+        pos += pc->len;
+    }
+    return DOC_NOLINE;
+}
+
+size_t ptLineCount(struct pieceTable *pt) { // lines in the document, DOC_UNKNOWN while indexing
+    size_t n = 1;
+    int i;
+    for (i = 0; i < pt->numpieces; i++) {
+        struct piece *pc = &pt->pieces[i];
+        if (pc->nl == PT_NLUNKNOWN) {
+            if (!ptIndexed(pt, pc->p, pc->len)) return DOC_UNKNOWN;
+            pc->nl = ptCount(pt, pc->p, pc->len);
+        }
+        n += pc->nl;
+    }
+    return n;
+}
+
+/*** Rope ***/
+/* A B+ tree whose leaves hold up to ROPE_LEAF_MAX bytes of text. Every
+   node caches the bytes and newlines beneath it, so finding an offset or a
+   line is one walk from the root. Leaves built from a file point into the
+   original buffer and copy it on first edit. Deletes keep the tree in
+   shape: a leaf left under ROPE_LEAF_MIN bytes, or an inner node left with
+   fewer than ROPE_FANOUT / 2 children, is merged with a neighbour or takes
+   some of its contents, so depth and node count follow the text's size. */
+#define ROPE_LEAF_MAX 4096                  // bytes in a full leaf
+#define ROPE_LEAF_FILL 2048                 // leaf size when loading a file
+#define ROPE_LEAF_MIN 1024                  // smaller leaves are merged after a delete
+
+int isUtf8Cont(int c) { return (c & 0xC0) == 0x80; } // UTF-8 continuation byte
+
+struct ropeNode *ropeNew(int leaf) {        // empty node
+    struct ropeNode *n = calloc(1, sizeof(*n));
+    if (n == NULL) die("calloc");
+    n->leaf = leaf;
+    return n;
+}
+
+void ropeFreeNode(struct ropeNode *n) {     // release a subtree
+    int i;
+    for (i = 0; i < n->n; i++) ropeFreeNode(n->kids[i]);
+    free(n->own);
+    free(n);
+}
+
+void ropeSum(struct ropeNode *n) {          // recompute an inner node's totals
+    int i;
+    n->bytes = n->lines = 0;
+    for (i = 0; i < n->n; i++) {
+        n->bytes += n->kids[i]->bytes;
+        n->lines += n->kids[i]->lines;
+    }
+}
+
+void ropeSetText(struct ropeNode *leaf, const char *p, size_t len) { // point a leaf at text
+    leaf->text = p;
+    leaf->bytes = len;
+    leaf->lines = countNewlines(p, len);
+}
+
+void ropeOwn(struct ropeNode *leaf) {       // private full-size copy, before editing
+    if (leaf->own) return;
+    leaf->own = malloc(ROPE_LEAF_MAX);
+    if (leaf->own == NULL) die("malloc");
+    if (leaf->bytes) memcpy(leaf->own, leaf->text, leaf->bytes);
+    leaf->text = leaf->own;
+}
+
+void ropeInit(struct rope *r, const char *orig, size_t len) { // balanced tree over orig
+    size_t num = len ? (len + ROPE_LEAF_FILL - 1) / ROPE_LEAF_FILL : 1, i, j;
+    struct ropeNode **level = malloc(sizeof(*level) * num);
+    if (level == NULL) die("malloc");
+    for (i = 0; i < num; i++) {             // leaves over the original text
+        size_t off = i * ROPE_LEAF_FILL;
+        level[i] = ropeNew(1);
+        if (len) ropeSetText(level[i], orig + off, len - off < ROPE_LEAF_FILL ? len - off : ROPE_LEAF_FILL);
+    }
+    while (num > 1) {                       // ROPE_FANOUT nodes under each parent
+        size_t parents = (num + ROPE_FANOUT - 1) / ROPE_FANOUT;
+        for (i = 0; i < parents; i++) {
+            struct ropeNode *p = ropeNew(0);
+            for (j = i * ROPE_FANOUT; j < num && j < (i + 1) * ROPE_FANOUT; j++) p->kids[p->n++] = level[j];
+            ropeSum(p);
+            level[i] = p;
+        }
+        num = parents;
+    }
+    r->root = level[0];
+    free(level);
+}
+
+void ropeFree(struct rope *r) {
+    if (r->root) ropeFreeNode(r->root);
+    r->root = NULL;
+}
+
+struct ropeNode *ropeSplitLeaf(struct ropeNode *leaf, size_t pos, const char *s, size_t len) {
+    char buf[ROPE_LEAF_MAX + ROPE_LEAF_MAX / 2]; // leaf plus the insertion no longer fits
+    size_t total = leaf->bytes + len, half = total / 2;
+    memcpy(buf, leaf->text, pos);
+    memcpy(buf + pos, s, len);
+    memcpy(buf + pos + len, leaf->text + pos, leaf->bytes - pos);
+    while (half < total && isUtf8Cont((unsigned char)buf[half])) half++; // keep characters whole
+
+    struct ropeNode *right = ropeNew(1);
+    ropeOwn(leaf);
+    ropeOwn(right);
+    memcpy(leaf->own, buf, half);
+    memcpy(right->own, buf + half, total - half);
+    ropeSetText(leaf, leaf->own, half);
+    ropeSetText(right, right->own, total - half);
+    return right;
+}
+
+struct ropeNode *ropeInsertAt(struct ropeNode *n, size_t pos, const char *s, size_t len) {
+    int i = 0;                              // returns n's new right sibling if n split
+    if (n->leaf) {
+        if (n->bytes + len > ROPE_LEAF_MAX) return ropeSplitLeaf(n, pos, s, len);
+        ropeOwn(n);
+        memmove(n->own + pos + len, n->own + pos, n->bytes - pos);
+        memcpy(n->own + pos, s, len);
+        n->bytes += len;
+        n->lines += countNewlines(s, len);
+        return NULL;
+    }
+
+    while (i < n->n - 1 && pos > n->kids[i]->bytes) pos -= n->kids[i++]->bytes;
+    struct ropeNode *right = ropeInsertAt(n->kids[i], pos, s, len), *sib = NULL, *t = n;
+    if (right) {
+        if (n->n == ROPE_FANOUT) {          // full: the upper half moves to a new sibling
+            sib = ropeNew(0);
+            sib->n = ROPE_FANOUT / 2;
+            memcpy(sib->kids, n->kids + ROPE_FANOUT / 2, sizeof(n->kids[0]) * sib->n);
+            n->n = ROPE_FANOUT / 2;
+            if (i >= n->n) {
+                t = sib;
+                i -= n->n;
+            }
+        }
+        memmove(&t->kids[i + 2], &t->kids[i + 1], sizeof(t->kids[0]) * (t->n - i - 1));
+        t->kids[i + 1] = right;
+        t->n++;
+        if (sib) ropeSum(sib);
+    }
+    ropeSum(n);
+    return sib;
+}
+
+void ropeInsert(struct rope *r, size_t pos, const char *s, size_t len) { // insert text
+    if (pos > r->root->bytes) pos = r->root->bytes;
+    while (len > 0) {                       // half a leaf at a time: one split at most
+        size_t n = len < ROPE_LEAF_MAX / 2 ? len : ROPE_LEAF_MAX / 2;
+        struct ropeNode *right = ropeInsertAt(r->root, pos, s, n);
+        if (right) {                        // the root split: grow a level
+            struct ropeNode *root = ropeNew(0);
+            root->kids[0] = r->root;
+            root->kids[1] = right;
+            root->n = 2;
+            ropeSum(root);
+            r->root = root;
+        }
+        pos += n;
+        s += n;
+        len -= n;
+    }
+}
+
+int ropeUnderfull(const struct ropeNode *n) { // a delete left n too small
+    return n->leaf ? n->bytes < ROPE_LEAF_MIN : n->n < ROPE_FANOUT / 2;
+}
+
+int ropeJoin(struct ropeNode *l, struct ropeNode *r) { // even out neighbours, 1 if all of r moved into l
+    if (l->leaf) {
+        char buf[2 * ROPE_LEAF_MAX];
+        size_t total = l->bytes + r->bytes, half = total / 2;
+        ropeOwn(l);
+        if (total <= ROPE_LEAF_MAX) {
+            memcpy(l->own + l->bytes, r->text, r->bytes);
+            ropeSetText(l, l->own, total);
+            return 1;
+        }
+        memcpy(buf, l->text, l->bytes);
+        memcpy(buf + l->bytes, r->text, r->bytes);
+        while (half < total && isUtf8Cont((unsigned char)buf[half])) half++; // keep characters whole
+        ropeOwn(r);
+        memcpy(l->own, buf, half);
+        memcpy(r->own, buf + half, total - half);
+        ropeSetText(l, l->own, half);
+        ropeSetText(r, r->own, total - half);
+        return 0;
+    }
+    int total = l->n + r->n, half = total / 2;
+    if (total <= ROPE_FANOUT) {
+        memcpy(l->kids + l->n, r->kids, sizeof(r->kids[0]) * r->n);
+        l->n = total;
+        r->n = 0;
+    } else if (l->n < half) {               // r's first children move over
+        memcpy(l->kids + l->n, r->kids, sizeof(r->kids[0]) * (half - l->n));
+        memmove(r->kids, r->kids + (half - l->n), sizeof(r->kids[0]) * (total - half));
+        r->n = total - half;
+        l->n = half;
+    } else {                                // l's last children move over
+        memmove(r->kids + (l->n - half), r->kids, sizeof(r->kids[0]) * r->n);
+        memcpy(r->kids, l->kids + half, sizeof(l->kids[0]) * (l->n - half));
+        r->n = total - half;
+        l->n = half;
+    }
+    ropeSum(l);
+    ropeSum(r);
+    return r->n == 0;
+}
+
+void ropeDeleteAt(struct ropeNode *n, size_t pos, size_t len) { // remove a range below n
+    int i, j;
+    if (n->leaf) {
+        if (pos == 0 && len == n->bytes) {  // whole leaf: the parent frees it
+            n->bytes = n->lines = 0;
+            return;
+        }
+        ropeOwn(n);
+        n->lines -= countNewlines(n->own + pos, len);
+        memmove(n->own + pos, n->own + pos + len, n->bytes - pos - len);
+        n->bytes -= len;
+        return;
+    }
+    for (i = 0; i < n->n && len > 0; i++) {
+        struct ropeNode *k = n->kids[i];
+        if (pos >= k->bytes) {
+            pos -= k->bytes;
+            continue;
+        }
+        size_t cut = k->bytes - pos < len ? k->bytes - pos : len;
+        ropeDeleteAt(k, pos, cut);
+        len -= cut;
+        pos = 0;
+    }
+    for (i = j = 0; i < n->n; i++) {        // drop children that became empty
+        if (n->kids[i]->bytes == 0) ropeFreeNode(n->kids[i]);
+        else n->kids[j++] = n->kids[i];
+    }
+    n->n = j;
+    for (i = 0; i < n->n && n->n > 1; i++) { // and fix up the ones left small
+        if (!ropeUnderfull(n->kids[i])) continue;
+        j = i + 1 < n->n ? i : i - 1;       // with the next one, or the one before the last
+        if (ropeJoin(n->kids[j], n->kids[j + 1])) {
+            ropeFreeNode(n->kids[j + 1]);
+            memmove(&n->kids[j + 1], &n->kids[j + 2], sizeof(n->kids[0]) * (n->n - j - 2));
+            n->n--;
+            i = j - 1;                      // the merged node may still be small
+        }
+    }
+    ropeSum(n);
+}
+
+void ropeDelete(struct rope *r, size_t pos, size_t len) { // remove text
+    if (pos >= r->root->bytes) return;
+    if (len > r->root->bytes - pos) len = r->root->bytes - pos;
+    if (len == 0) return;
+    ropeDeleteAt(r->root, pos, len);
+    while (!r->root->leaf && r->root->n <= 1) { // single child: drop a level
+        struct ropeNode *old = r->root;
+        r->root = old->n ? old->kids[0] : ropeNew(1);
+        old->n = 0;
+        ropeFreeNode(old);
+    }
+}
+
+const char *ropeSpan(struct rope *r, size_t pos, size_t *len) { // contiguous text at pos
+    struct ropeNode *n = r->root;
+    if (pos >= n->bytes) { *len = 0; return NULL; }
+    while (!n->leaf) {
+        int i = 0;
+        while (pos >= n->kids[i]->bytes) pos -= n->kids[i++]->bytes;
+        n = n->kids[i];
+    }
+    *len = n->bytes - pos;
+    return n->text + pos;
+}
+
+size_t ropeLineStart(struct rope *r, size_t line) { // offset of a line's first byte
+    struct ropeNode *n = r->root;
+    size_t pos = 0;
+    if (line == 0) return 0;
+    if (line > n->lines) return DOC_NOLINE;
+    while (!n->leaf) {                      // child holding newline number `line`
+        int i = 0;
+        while (n->kids[i]->lines < line) {
+            line -= n->kids[i]->lines;
+            pos += n->kids[i++]->bytes;
+        }
+        n = n->kids[i];
+    }
+    return pos + (nlScan(n->text, n->bytes, line, NULL) - n->text) + 1;
+}
+
+/*** Row Array ***/
+/* The layout kilo started from: one allocation per line. Finding a line
+   is an array index, but offsets are a running sum that each edit
+   invalidates from the edited row on, and splitting or joining lines
+   moves the whole tail of the array. Kept to measure the others against.
+   Each row is a gap buffer: the gap follows the last edit, so typing at
+   the cursor fills the gap instead of shifting the rest of the line, and
+   spans hand out the text on either side of it without closing it. */
+#define ROW_GAP_MIN 16                      // smallest gap opened by an insert
+
+void rowsReserve(struct rowArray *ra, size_t n) { // room for n more rows
+    if (ra->numrows + n <= ra->caprows) return;
+    size_t cap = ra->caprows ? ra->caprows * 2 : 64;
+    while (cap < ra->numrows + n) cap *= 2;
+    ra->rows = realloc(ra->rows, sizeof(struct textRow) * cap);
+    ra->offs = realloc(ra->offs, sizeof(size_t) * cap);
+    if (ra->rows == NULL || ra->offs == NULL) die("realloc");
+    ra->caprows = cap;
+}
+
+void rowsSet(struct textRow *row, const char *s, size_t len) { // copy text into a row, no gap
+    row->chars = malloc(len ? len : 1);
+    if (row->chars == NULL) die("malloc");
+    if (len) memcpy(row->chars, s, len);
+    row->len = row->gap = len;
+    row->gaplen = 0;
+}
+
+void rowMoveGap(struct textRow *row, size_t col) { // put the gap at col
+    if (col < row->gap)                     // text between col and the gap moves right
+        memmove(row->chars + col + row->gaplen, row->chars + col, row->gap - col);
+    else if (col > row->gap)                // text after the gap moves left
+        memmove(row->chars + row->gap, row->chars + row->gap + row->gaplen, col - row->gap);
+    row->gap = col;
+}
+
+void rowInsert(struct textRow *row, size_t col, const char *s, size_t len) { // insert into a row
+    if (row->gaplen < len) {                // grow: double, with the gap at the end
+        size_t gaplen = row->len + len;
+        if (gaplen < ROW_GAP_MIN) gaplen = ROW_GAP_MIN;
+        rowMoveGap(row, row->len);
+        row->chars = realloc(row->chars, row->len + gaplen);
+        if (row->chars == NULL) die("realloc");
+        row->gaplen = gaplen;
+    }
+    rowMoveGap(row, col);
+    memcpy(row->chars + col, s, len);
+    row->gap += len;
+    row->gaplen -= len;
+    row->len += len;
+}
+
+void rowDelete(struct textRow *row, size_t col, size_t len) { // remove bytes from a row
+    rowMoveGap(row, col);
+    row->gaplen += len;                     // the deleted bytes join the gap
+    row->len -= len;
+}
+
+const char *rowTail(struct textRow *row, size_t col) { // contiguous text from col to the end
+    rowMoveGap(row, col);
+    return row->chars + col + row->gaplen;
+}
+
+void rowsInit(struct rowArray *ra, const char *orig, size_t len) { // copy every line out
+    const char *p = orig, *nl;
+    memset(ra, 0, sizeof(*ra));
+    do {
+        size_t left = len - (p - orig), n;
+        nl = left ? memchr(p, '\n', left) : NULL;
+        n = nl ? (size_t)(nl - p) : left;
+        rowsReserve(ra, 1);
+        rowsSet(&ra->rows[ra->numrows++], p, n);
+        if (nl) p = nl + 1;
+    } while (nl);
+    ra->len = len;
+}
+
+void rowsFree(struct rowArray *ra) {
+    size_t i;
+    for (i = 0; i < ra->numrows; i++) free(ra->rows[i].chars);
+    free(ra->rows);
+    free(ra->offs);
+    memset(ra, 0, sizeof(*ra));
+}
+
+size_t rowsOffset(struct rowArray *ra, size_t row) { // document offset of a row
+    if (ra->numvalid == 0) {
+        ra->offs[0] = 0;
+        ra->numvalid = 1;
+    }
+    while (ra->numvalid <= row) {           // extend the running sum
+        size_t i = ra->numvalid++;
+        ra->offs[i] = ra->offs[i - 1] + ra->rows[i - 1].len + 1;
+    }
+    return ra->offs[row];
+}
+
+size_t rowsLocate(struct rowArray *ra, size_t pos, size_t *col) { // row holding pos
+    size_t lo = 0, hi;
+    rowsOffset(ra, 0);
+    while (ra->numvalid < ra->numrows && ra->offs[ra->numvalid - 1] <= pos)
+        rowsOffset(ra, ra->numvalid);
+    hi = ra->numvalid;                      // last row starting at or before pos
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ra->offs[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    *col = pos - ra->offs[lo];
+    return lo;
+}
+
+const char *rowsSpan(struct rowArray *ra, size_t pos, size_t *len) { // contiguous text at pos
+    size_t col, r;
+    if (pos >= ra->len) { *len = 0; return NULL; }
+    r = rowsLocate(ra, pos, &col);
+    struct textRow *row = &ra->rows[r];
+    if (col == row->len) {                  // the newline between two rows
+        *len = 1;
+        return "\n";
+    }
+    if (col < row->gap) {                   // before the gap
+        *len = row->gap - col;
+        return row->chars + col;
+    }
+    *len = row->len - col;                  // after the gap
+    return row->chars + row->gaplen + col;
+}
+
+size_t rowsLineStart(struct rowArray *ra, size_t line) { // offset of a line's first byte
+    return line < ra->numrows ? rowsOffset(ra, line) : DOC_NOLINE;
+}
+
+void rowsInsert(struct rowArray *ra, size_t pos, const char *s, size_t len) { // insert text
+    size_t col, r, k = countNewlines(s, len), i;
+    if (len == 0) return;
+    if (pos > ra->len) pos = ra->len;
+    r = rowsLocate(ra, pos, &col);
+    if (k == 0) {                           // stays on one line
+        rowInsert(&ra->rows[r], col, s, len);
+    } else {                                // new rows push the rest of the array down
+        rowsReserve(ra, k);
+        memmove(&ra->rows[r + k + 1], &ra->rows[r + 1], sizeof(struct textRow) * (ra->numrows - r - 1));
+        ra->numrows += k;
+        struct textRow *row = &ra->rows[r];
+        size_t taillen = row->len - col;
+        const char *tail = rowTail(row, col), *first = memchr(s, '\n', len), *nl = first;
+        for (i = 1; i <= k; i++) {          // lines after the first, the last takes the tail
+            const char *next = i < k ? memchr(nl + 1, '\n', s + len - nl - 1) : s + len;
+            rowsSet(&ra->rows[r + i], nl + 1, next - nl - 1);
+            if (i == k) rowInsert(&ra->rows[r + k], next - nl - 1, tail, taillen);
+            nl = next;
+        }
+        rowDelete(row, col, taillen);       // the first line keeps its head
+        rowInsert(row, col, s, first - s);
+    }
+    if (ra->numvalid > r + 1) ra->numvalid = r + 1;
+    ra->len += len;
+}
+
+void rowsDelete(struct rowArray *ra, size_t pos, size_t len) { // remove text
+    size_t c1, c2, r1, r2, i;
+    if (pos >= ra->len) return;
+    if (len > ra->len - pos) len = ra->len - pos;
+    if (len == 0) return;
+    r2 = rowsLocate(ra, pos + len, &c2);
+    r1 = rowsLocate(ra, pos, &c1);
+    struct textRow *a = &ra->rows[r1], *b = &ra->rows[r2];
+    if (r1 == r2) {
+        rowDelete(a, c1, len);
+    } else {                                // join the first and last rows
+        rowDelete(a, c1, a->len - c1);
+        rowInsert(a, c1, rowTail(b, c2), b->len - c2);
+        for (i = r1 + 1; i <= r2; i++) free(ra->rows[i].chars);
+        memmove(&ra->rows[r1 + 1], &ra->rows[r2 + 1], sizeof(struct textRow) * (ra->numrows - r2 - 1));
+        ra->numrows -= r2 - r1;
+    }
+    if (ra->numvalid > r1 + 1) ra->numvalid = r1 + 1;
+    ra->len -= len;
+}
+
+/*** Document ***/
+/* The editor reaches its text only through the doc* calls below, which
+   forward to the backend picked at startup with KILO_BACKEND: "piece"
+   (default: zero-copy, indexed in the background), "rope" or "rows". */
+void docPieceInit(const char *orig, size_t len, int fd) { ptInit(&E.pt, orig, len, fd); }
+void docPieceFree(void) { ptFree(&E.pt); }
+void docPieceInsert(size_t pos, const char *s, size_t len) { ptInsert(&E.pt, pos, s, len); }
+void docPieceDelete(size_t pos, size_t len) { ptDelete(&E.pt, pos, len); }
+const char *docPieceSpan(size_t pos, size_t *len) { return ptSpan(&E.pt, pos, len); }
+size_t docPieceLineStart(size_t line) { return ptLineStart(&E.pt, line); }
+size_t docPieceLineCount(void) { return ptLineCount(&E.pt); }
+size_t docPieceLength(void) { return E.pt.len; }
+int docPieceProgress(void) { return liProgress(&E.pt.idx); }
+
+void docRopeInit(const char *orig, size_t len, int fd) { (void)fd; ropeInit(&E.rope, orig, len); }
+void docRopeFree(void) { ropeFree(&E.rope); }
+void docRopeInsert(size_t pos, const char *s, size_t len) { ropeInsert(&E.rope, pos, s, len); }
+void docRopeDelete(size_t pos, size_t len) { ropeDelete(&E.rope, pos, len); }
+const char *docRopeSpan(size_t pos, size_t *len) { return ropeSpan(&E.rope, pos, len); }
+size_t docRopeLineStart(size_t line) { return ropeLineStart(&E.rope, line); }
+size_t docRopeLineCount(void) { return E.rope.root->lines + 1; }
+size_t docRopeLength(void) { return E.rope.root->bytes; }
+
+void docRowsInit(const char *orig, size_t len, int fd) { (void)fd; rowsInit(&E.rows, orig, len); }
+void docRowsFree(void) { rowsFree(&E.rows); }
+void docRowsInsert(size_t pos, const char *s, size_t len) { rowsInsert(&E.rows, pos, s, len); }
+void docRowsDelete(size_t pos, size_t len) { rowsDelete(&E.rows, pos, len); }
+const char *docRowsSpan(size_t pos, size_t *len) { return rowsSpan(&E.rows, pos, len); }
+size_t docRowsLineStart(size_t line) { return rowsLineStart(&E.rows, line); }
+size_t docRowsLineCount(void) { return E.rows.numrows; }
+size_t docRowsLength(void) { return E.rows.len; }
+
+int docLoaded(void) { return 100; }         // backends that count everything up front
+
+const struct docBackend docBackends[] = {
+    {"piece", docPieceInit, docPieceFree, docPieceInsert, docPieceDelete, docPieceSpan,
+     docPieceLineStart, docPieceLineCount, docPieceLength, docPieceProgress},
+    {"rope", docRopeInit, docRopeFree, docRopeInsert, docRopeDelete, docRopeSpan,
+     docRopeLineStart, docRopeLineCount, docRopeLength, docLoaded},
+    {"rows", docRowsInit, docRowsFree, docRowsInsert, docRowsDelete, docRowsSpan,
+     docRowsLineStart, docRowsLineCount, docRowsLength, docLoaded},
+};
+
+int docSelect(const char *name) {           // pick a backend, NULL for the default
+    size_t i;
+    for (i = 0; i < sizeof(docBackends) / sizeof(docBackends[0]); i++) {
+        if (name == NULL || strcmp(name, docBackends[i].name) == 0) {
+            E.docops = &docBackends[i];
+            return 0;
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+void docInit(const char *orig, size_t len, int notifyfd) {
+    E.docversion++;
+    E.docops->init(orig, len, notifyfd);
+}
+void docFree(void) { E.docops->free(); }
+void docInsert(size_t pos, const char *s, size_t len) {
+    E.docversion++;
+    E.docops->insert(pos, s, len);
+}
+void docDelete(size_t pos, size_t len) {
+    E.docversion++;
+    E.docops->del(pos, len);
+}
+const char *docSpan(size_t pos, size_t *len) { return E.docops->span(pos, len); }
+size_t docLineStart(size_t line) { return E.docops->lineStart(line); }
+size_t docLineCount(void) { return E.docops->lineCount(); }
+size_t docLength(void) { return E.docops->length(); }
+int docProgress(void) { return E.docops->progress(); }
+
+/* Backends move their lookup hints and fill in offsets as they are read,
+   so only the main thread may call them. Other threads read a docView:
+   the spans copied out once, which stays good until the next edit. */
+void docViewTake(struct docView *v) {      // snapshot the spans, unless nothing changed since
+    size_t pos = 0, n;
+    const char *p;
+    if (v->spans && v->version == E.docversion) return;
+    v->numspans = 0;
+    while ((p = docSpan(pos, &n)) != NULL) {
+        struct docSpanRef *last = v->numspans ? &v->spans[v->numspans - 1] : NULL;
+        if (last && last->p + last->len == p) { // rope leaves of one mapping, typed runs
+            last->len += n;
+        } else {
+            if (v->numspans == v->cap) {
+                v->cap = v->cap ? v->cap * 2 : 64;
+                v->spans = realloc(v->spans, sizeof(struct docSpanRef) * v->cap);
+                if (v->spans == NULL) die("realloc");
+            }
+            v->spans[v->numspans++] = (struct docSpanRef){pos, p, n};
+        }
+        pos += n;
+    }
+    v->len = pos;
+    v->version = E.docversion;
+}
+
+const char *docViewSpan(const struct docView *v, size_t pos, size_t *len) { // docSpan(), NULL v for the live document
+    size_t lo = 0, hi;
+    if (v == NULL) return docSpan(pos, len);
+    if (pos >= v->len) { *len = 0; return NULL; }
+    hi = v->numspans;                       // last span starting at or before pos
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (v->spans[mid].pos <= pos) lo = mid;
+        else hi = mid;
+    }
+    *len = v->spans[lo].len - (pos - v->spans[lo].pos);
+    return v->spans[lo].p + (pos - v->spans[lo].pos);
+}
+
+size_t docViewLength(const struct docView *v) { return v ? v->len : docLength(); }
+
+size_t docViewRead(const struct docView *v, size_t pos, char *dst, size_t len) { // copy a range out
+    size_t done = 0, n;
+    const char *p;
+    while (done < len && (p = docViewSpan(v, pos + done, &n)) != NULL) {
+        if (n > len - done) n = len - done;
+        memcpy(dst + done, p, n);
+        done += n;
+    }
+    return done;
+}
+
+size_t docViewLineEnd(const struct docView *v, size_t pos) { // offset of the '\n' ending a line
+    size_t n;
+    const char *p;
+    while ((p = docViewSpan(v, pos, &n)) != NULL) {
+        const char *nl = memchr(p, '\n', n);
+        if (nl) return pos + (nl - p);
+        pos += n;
+    }
+    return docViewLength(v);
+}
+
+size_t docRead(size_t pos, char *dst, size_t len) { return docViewRead(NULL, pos, dst, len); }
+size_t docLineEnd(size_t pos) { return docViewLineEnd(NULL, pos); }
+
+/*** Syntax Highlighting ***/
+/* The lexer's state at the end of every line is stored, so any line can
+   be highlighted from the state of the one above it. An edit marks its
+   lines stale; they are re-lexed from the first stale line until a line
+   past the edit ends in the same state as before, since everything below
+   then lexes the same way. Rows on screen keep their highlight until
+   their text or entry state changes.
+
+   Lexing runs on a worker thread, so a huge file never holds up a key.
+   The main thread copies lines into a job; the worker lexes the copy and
+   hands the job back on a completion queue whose pipe the event loop
+   watches. Visible rows go out as their own job, lexed from the stored
+   state above them (or from normal text while that is not known yet),
+   and the worker takes it before the end states, which it carries
+   outward to the end of the file in HL_JOB_BYTES steps. A row whose job
+   has not come back yet is drawn plain. */
+#define HL_NONE ((size_t)-1)                // no line
+#define HL_MAX_LINE (1024 * 1024)           // longer lines are shown plain
+#define HL_JOB_BYTES (64 * 1024)            // text per end-state job
+#define HL_NORMAL 0                         // lexer states carried across lines
+#define HL_IN_COMMENT 1                     // or the quote of an open string
+
+const char *cExtensions[] = {".c", ".h", ".cpp", ".cc", ".hpp", NULL};
+const char *cKeywords[] = {
+    "switch", "if", "while", "for", "break", "continue", "return", "else",
+    "struct", "union", "typedef", "static", "enum", "class", "case", "default",
+    "do", "goto", "sizeof", "const", "volatile", "extern", "register",
+    "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|",
+    "void|", "short|", "size_t|", "ssize_t|", NULL,
+};
+
+const char *sqlExtensions[] = {".sql", NULL};
+const char *sqlKeywords[] = {            // as dump tools write them
+    "SELECT", "INSERT", "INTO", "VALUES", "UPDATE", "DELETE", "FROM", "WHERE",
+    "CREATE", "DROP", "ALTER", "TABLE", "INDEX", "VIEW", "DATABASE", "IF",
+    "EXISTS", "NOT", "NULL", "DEFAULT", "PRIMARY", "FOREIGN", "KEY", "UNIQUE",
+    "REFERENCES", "CONSTRAINT", "LOCK", "UNLOCK", "TABLES", "WRITE", "SET",
+    "AND", "OR", "BEGIN", "COMMIT", "ENGINE", "AUTO_INCREMENT", "CHARSET",
+    "INT|", "INTEGER|", "BIGINT|", "SMALLINT|", "TINYINT|", "DECIMAL|",
+    "FLOAT|", "DOUBLE|", "CHAR|", "VARCHAR|", "TEXT|", "BLOB|", "DATE|",
+    "DATETIME|", "TIMESTAMP|", "BOOLEAN|", NULL,
+};
+
+const struct editorSyntax HLDB[] = {
+    {"c", cExtensions, cKeywords, "//", "/*", "*/"},
+    {"sql", sqlExtensions, sqlKeywords, "--", "/*", "*/"},
+};
+
+int hlSeparator(int c) {                    // ends a word or a number
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+int hlLexText(const struct editorSyntax *syn, const char *s, size_t len, int state,
+              unsigned char *hl) {          // end-of-line state, ATTR_* per byte into hl
+    size_t cl = strlen(syn->comment), msl = strlen(syn->mlstart), mel = strlen(syn->mlend);
+    size_t i = 0, j;
+    int prevsep = 1;
+    while (i < len) {
+        char c = s[i];
+        int prevhl = i > 0 && hl ? hl[i - 1] : ATTR_NORMAL;
+        if (state == HL_IN_COMMENT) {
+            if (len - i >= mel && memcmp(s + i, syn->mlend, mel) == 0) {
+                if (hl) memset(hl + i, ATTR_COMMENT, mel);
+                i += mel;
+                state = HL_NORMAL;
+                prevsep = 1;
+            } else {
+                if (hl) hl[i] = ATTR_COMMENT;
+                i++;
+            }
+            continue;
+        }
+        if (state != HL_NORMAL) {           // inside a string opened by that quote
+            if (hl) hl[i] = ATTR_STRING;
+            if (c == '\\' && i + 1 < len) {
+                if (hl) hl[i + 1] = ATTR_STRING;
+                i += 2;
+                continue;
+            }
+            if (c == state) state = HL_NORMAL;
+            i++;
+            prevsep = 1;
+            continue;
+        }
+        if (len - i >= cl && memcmp(s + i, syn->comment, cl) == 0) {
+            if (hl) memset(hl + i, ATTR_COMMENT, len - i);
+            break;
+        }
+        if (len - i >= msl && memcmp(s + i, syn->mlstart, msl) == 0) {
+            if (hl) memset(hl + i, ATTR_COMMENT, msl);
+            i += msl;
+            state = HL_IN_COMMENT;
+            continue;
+        }
+        if (c == '"' || c == '\'') {
+            if (hl) hl[i] = ATTR_STRING;
+            state = c;
+            i++;
+            continue;
+        }
+        if ((isdigit((unsigned char)c) && (prevsep || prevhl == ATTR_NUMBER)) ||
+            (c == '.' && prevhl == ATTR_NUMBER)) {
+            if (hl) hl[i] = ATTR_NUMBER;
+            i++;
+            prevsep = 0;
+            continue;
+        }
+        if (prevsep) {                      // a keyword must start and end at a separator
+            for (j = 0; syn->keywords[j]; j++) {
+                if (syn->keywords[j][0] != c) continue; // cheap reject before strlen()
+                size_t klen = strlen(syn->keywords[j]);
+                int kw2 = syn->keywords[j][klen - 1] == '|';
+                if (kw2) klen--;
+                if (len - i >= klen && memcmp(s + i, syn->keywords[j], klen) == 0 &&
+                    (i + klen == len || hlSeparator((unsigned char)s[i + klen]))) {
+                    if (hl) memset(hl + i, kw2 ? ATTR_KEYWORD2 : ATTR_KEYWORD1, klen);
+                    i += klen;
+                    break;
+                }
+            }
+            if (syn->keywords[j] != NULL) {
+                prevsep = 0;
+                continue;
+            }
+        }
+        if (hl) hl[i] = ATTR_NORMAL;
+        prevsep = hlSeparator((unsigned char)c);
+        i++;
+    }
+    if (state != HL_NORMAL && state != HL_IN_COMMENT && (len == 0 || s[len - 1] != '\\'))
+        state = HL_NORMAL;                  // strings only continue after a backslash
+    return state;
+}
+
+int hlQueuePush(struct hlQueue *q, struct hlJob *j) { // producer, 0 when full
+    unsigned head = q->head;
+    if (head - __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == HL_QUEUE) return 0;
+    q->slot[head % HL_QUEUE] = j;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE); // publish after the slot
+    return 1;
+}
+
+struct hlJob *hlQueuePeek(struct hlQueue *q) { // consumer, NULL when empty
+    unsigned tail = q->tail;
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) return NULL;
+    return q->slot[tail % HL_QUEUE];
+}
+
+void hlQueuePop(struct hlQueue *q) {        // consumer is done with the oldest slot
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_RELEASE);
+}
+
+void hlFinish(struct hlJob *j) {            // queue a lexed job for the main thread
+    hlQueuePush(&E.hl.done, j);             // never full: at most one job of each kind
+    if (write(E.hl.notify[1], "h", 1) == -1 && errno != EAGAIN) die("write");
+}
+
+void hlRun(struct hlJob *j) {               // worker: lex a job's lines
+    struct hlJob *rows;
+    size_t i, off = 0;
+    int state = j->entry[0];
+    for (i = 0; i < j->numlines; i++) {
+        if (__atomic_load_n(&E.hl.gen, __ATOMIC_RELAXED) != j->gen) break; // edited meanwhile: dropped anyway
+        if (j->op == HL_JOB_ROWS) {
+            state = j->entry[i];            // rows stand alone
+        } else if ((rows = hlQueuePeek(&E.hl.todo[HL_JOB_ROWS])) != NULL) {
+            hlRun(rows);                    // visible rows go ahead of end states
+            hlQueuePop(&E.hl.todo[HL_JOB_ROWS]);
+            hlFinish(rows);
+        }
+        if (j->lens[i] != HL_NONE) {
+            state = hlLexText(j->syntax, j->text + off, j->lens[i], state,
+                              j->op == HL_JOB_ROWS ? j->hl + off : NULL);
+            off += j->lens[i];
+        }
+        if (i < j->numold && i >= j->converge && j->ends[i] == state) {
+            j->numlines = i + 1;            // the lines below lex as before
+            break;
+        }
+        j->ends[i] = state;
+    }
+}
+
+void *hlWorker(void *arg) {                 // the highlight thread
+    char buf[64];
+    (void)arg;
+    while (1) {
+        struct hlJob *j = hlQueuePeek(&E.hl.todo[HL_JOB_ROWS]);
+        int op = HL_JOB_ROWS;
+        if (j == NULL) j = hlQueuePeek(&E.hl.todo[op = HL_JOB_STATES]);
+        if (j == NULL) {                    // sleep until hlPush() writes a byte
+            if (read(E.hl.wake[0], buf, sizeof(buf)) == -1 && errno != EINTR) die("read");
+            continue;
+        }
+        hlRun(j);
+        hlQueuePop(&E.hl.todo[op]);
+        hlFinish(j);
+    }
+}
+
+void hlStart(void) {                        // pipes, then the worker if we can
+    int i;
+    makePipe(E.hl.notify);
+    if (pipe(E.hl.wake) == -1) die("pipe"); // blocking reads: the worker sleeps in read()
+    fcntl(E.hl.wake[1], F_SETFL, fcntl(E.hl.wake[1], F_GETFL) | O_NONBLOCK);
+    for (i = 0; i < 2; i++) fcntl(E.hl.wake[i], F_SETFD, FD_CLOEXEC);
+    E.hl.running = pthread_create(&E.hl.thread, NULL, hlWorker, NULL) == 0;
+}
+
+struct hlJob *hlJobStart(int op, size_t line) { // main thread: empty job of a kind
+    struct hlJob *j = &E.hl.jobs[op];
+    j->op = op;
+    j->gen = E.hl.gen;
+    j->syntax = E.hl.syntax;
+    j->line = line;
+    j->numlines = j->len = j->numold = 0;
+    return j;
+}
+
+void hlJobAdd(struct hlJob *j, size_t pos, size_t len, int entry) { // copy len bytes of a line
+    if (j->numlines == j->linecap) {
+        j->linecap = j->linecap ? j->linecap * 2 : 256;
+        j->lens = realloc(j->lens, sizeof(size_t) * j->linecap);
+        j->entry = realloc(j->entry, j->linecap);
+        j->ends = realloc(j->ends, j->linecap);
+        if (j->lens == NULL || j->entry == NULL || j->ends == NULL) die("realloc");
+    }
+    j->entry[j->numlines] = entry;
+    j->lens[j->numlines++] = len;
+    if (len == HL_NONE) return;
+    if (j->len + len > j->cap) {
+        j->cap = (j->len + len) * 2;
+        j->text = realloc(j->text, j->cap);
+        if (j->text == NULL) die("realloc");
+    }
+    if (j->op == HL_JOB_ROWS && j->cap > j->hlcap) {
+        j->hlcap = j->cap;
+        j->hl = realloc(j->hl, j->hlcap);
+        if (j->hl == NULL) die("realloc");
+    }
+    docRead(pos, j->text + j->len, len);
+    j->len += len;
+}
+
+void hlPush(struct hlJob *j) {              // main thread: hand a job to the worker
+    E.hl.busy[j->op] = 1;
+    if (!E.hl.running) {                    // no thread: lex inline, deliver the same way
+        hlRun(j);
+        hlFinish(j);
+        return;
+    }
+    hlQueuePush(&E.hl.todo[j->op], j);      // never full: at most one job of each kind
+    if (write(E.hl.wake[1], "h", 1) == -1 && errno != EAGAIN) die("write");
+}
+
+void hlForgetRows(void) {                   // line numbers moved: drop cached rows
+    int i;
+    for (i = 0; i < HL_ROWS; i++) E.hl.rows[i].line = HL_NONE;
+}
+
+void hlEdited(void) {                       // text changed: jobs in flight are out of date
+    __atomic_store_n(&E.hl.gen, E.hl.gen + 1, __ATOMIC_RELAXED); // the worker polls it
+    E.hl.cutline = HL_NONE;
+}
+
+void hlReset(void) {                        // forget every state, keep the language
+    free(E.hl.state);
+    E.hl.state = NULL;
+    E.hl.numstates = E.hl.cap = 0;
+    E.hl.stale = HL_NONE;
+    E.hl.staleend = 0;
+    hlForgetRows();
+    hlEdited();
+}
+
+void hlSelect(const char *filename) {       // pick a language by file name
+    const char *ext = filename ? strrchr(filename, '.') : NULL;
+    size_t i, j;
+    E.hl.syntax = NULL;
+    hlReset();
+    for (i = 0; ext && i < sizeof(HLDB) / sizeof(HLDB[0]); i++)
+        for (j = 0; HLDB[i].filematch[j]; j++)
+            if (strcmp(ext, HLDB[i].filematch[j]) == 0) E.hl.syntax = &HLDB[i];
+}
+
+void hlMarkStale(size_t from, size_t to) {  // lines from..to were edited
+    if (from < E.hl.stale || E.hl.stale == HL_NONE) E.hl.stale = from;
+    if (to + 1 > E.hl.staleend) E.hl.staleend = to + 1;
+    hlEdited();
+}
+
+void hlEditLine(size_t line) {              // text changed within one line
+    E.hl.rows[line % HL_ROWS].line = HL_NONE;
+    hlMarkStale(line, line);
+}
+
+void hlInsertLines(size_t line, size_t n) { // line was split into n + 1 lines
+    struct highlighter *h = &E.hl;
+    if (line < h->numstates) {              // make room for the new lines' states
+        if (h->numstates + n > h->cap) {
+            h->cap = (h->numstates + n) * 2;
+            h->state = realloc(h->state, h->cap);
+            if (h->state == NULL) die("realloc");
+        }
+        memmove(h->state + line + n, h->state + line, h->numstates - line);
+        h->numstates += n;
+    }
+    if (h->staleend > line) h->staleend += n;
+    hlForgetRows();
+    hlMarkStale(line, line + n);
+}
+
+void hlDeleteLines(size_t line, size_t n) { // lines line + 1 .. line + n were joined onto line
+    struct highlighter *h = &E.hl;
+    if (line + n < h->numstates) {          // the joined line ends where line + n did
+        memmove(h->state + line, h->state + line + n, h->numstates - line - n);
+        h->numstates -= n;
+    } else if (line < h->numstates) {
+        h->numstates = line + 1;
+    }
+    if (h->staleend > line + n) h->staleend -= n;
+    else if (h->staleend > line) h->staleend = line + 1;
+    hlForgetRows();
+    hlMarkStale(line, line);
+}
+
+int hlApplyStates(struct hlJob *j, size_t first, size_t last) { // 1 if a visible row's entry moved
+    struct highlighter *h = &E.hl;
+    size_t i, line;
+    int moved = 0;
+    for (i = 0; i < j->numlines; i++) {
+        line = j->line + i;
+        if (line + 1 >= first && line + 1 < last) moved = 1;
+        if (h->stale != HL_NONE) {          // re-lexing edits until the states agree again
+            int same = j->ends[i] == h->state[line];
+            h->state[line] = j->ends[i];
+            h->stale = line + 1;
+            if (same && h->stale >= h->staleend) { // converged: the rest was right already
+                h->stale = HL_NONE;
+                h->staleend = 0;
+                break;
+            }
+            if (h->stale >= h->staleend) h->staleend = h->stale + 1; // next line's start state moved
+            if (h->stale >= h->numstates) { // past what was ever lexed: the rest is new
+                h->stale = HL_NONE;
+                h->staleend = 0;
+            }
+            continue;
+        }
+        if (h->numstates == h->cap) {       // lines never lexed before
+            h->cap = h->cap ? h->cap * 2 : 4096;
+            h->state = realloc(h->state, h->cap);
+            if (h->state == NULL) die("realloc");
+        }
+        h->state[h->numstates++] = j->ends[i];
+    }
+    return moved;
+}
+
+void hlApplyRows(struct hlJob *j) {         // cache the spans of lexed rows
+    size_t i, off = 0;
+    for (i = 0; i < j->numlines; i++) {
+        struct hlRow *row = &E.hl.rows[(j->line + i) % HL_ROWS];
+        size_t len = j->lens[i] == HL_NONE ? 0 : j->lens[i];
+        if (len > row->cap) {
+            row->cap = len * 2;
+            row->hl = realloc(row->hl, row->cap);
+            if (row->hl == NULL) die("realloc");
+        }
+        if (len) memcpy(row->hl, j->hl + off, len);
+        row->len = len;
+        row->upto = j->lens[i];
+        row->state = j->entry[i];
+        row->line = j->line + i;
+        off += len;
+    }
+}
+
+int hlCollect(size_t first, size_t last) {  // take finished jobs, 1 if rows first..last changed
+    struct hlJob *j;
+    int changed = 0;
+    while ((j = hlQueuePeek(&E.hl.done)) != NULL) {
+        hlQueuePop(&E.hl.done);
+        E.hl.busy[j->op] = 0;
+        if (j->gen != E.hl.gen) continue;   // cut before an edit: redone from the new text
+        E.hl.lexed += j->numlines;
+        if (j->op == HL_JOB_ROWS) {
+            hlApplyRows(j);
+            changed = 1;
+        } else if (hlApplyStates(j, first, last)) {
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+size_t hlRowBytes(void) {                   // bytes of a line that can reach the screen
+    return (E.coloff + E.screencols) * 4 + 64; // UTF-8 is at most 4 per column, 64 for a cut word
+}
+
+int hlEntry(size_t line, int *state) {      // state a line starts in, 0 if only a guess
+    if (line == 0) *state = HL_NORMAL;
+    else if (line - 1 < E.hl.numstates) *state = E.hl.state[line - 1];
+    else *state = HL_NORMAL;                // not reached yet: most lines start there
+    return line == 0 || line - 1 < E.hl.numstates;
+}
+
+struct hlRow *hlRowFor(size_t line, size_t len) { // cached spans for a visible line, or NULL
+    struct hlRow *row = &E.hl.rows[line % HL_ROWS];
+    size_t need = len < hlRowBytes() ? len : hlRowBytes();
+    int state;
+    if (E.hl.syntax == NULL || row->line != line || row->upto < need) return NULL;
+    if (hlEntry(line, &state) && row->state != state) return NULL;
+    return row;
+}
+
+void hlCutStates(void) {                    // queue the next end states to work out
+    struct highlighter *h = &E.hl;
+    size_t line, pos, end;
+    if (h->stale != HL_NONE && h->stale >= h->numstates) {
+        h->stale = HL_NONE;                 // the edits lie past what was lexed
+        h->staleend = 0;
+    }
+    line = h->stale != HL_NONE ? h->stale : h->numstates;
+    pos = line == h->cutline ? h->cutpos : docLineStart(line);
+    if (pos == DOC_NOLINE) {                // text got shorter, or everything is lexed
+        if (h->numstates > line) h->numstates = line;
+        h->stale = HL_NONE;
+        h->staleend = 0;
+        return;
+    }
+    struct hlJob *j = hlJobStart(HL_JOB_STATES, line);
+    while (pos != DOC_NOLINE && j->len < HL_JOB_BYTES) {
+        end = docLineEnd(pos);
+        hlJobAdd(j, pos, end - pos > HL_MAX_LINE ? HL_NONE : end - pos,
+                 j->numlines ? 0 : line ? h->state[line - 1] : HL_NORMAL);
+        pos = end < docLength() ? end + 1 : DOC_NOLINE;
+    }
+    if (h->stale != HL_NONE) {              // the worker stops once the states agree
+        j->numold = h->numstates - line < j->numlines ? h->numstates - line : j->numlines;
+        memcpy(j->ends, h->state + line, j->numold);
+        j->converge = h->staleend > line ? h->staleend - line - 1 : 0;
+    }
+    h->cutline = line + j->numlines;
+    h->cutpos = pos;
+    hlPush(j);
+}
+
+void hlContinue(void) {                     // keep the worker on end states while there are any
+    if (E.hl.syntax && !E.hl.busy[HL_JOB_STATES]) hlCutStates();
+}
+
+int hlSchedule(size_t first, size_t last) { // queue visible rows, then end states
+    size_t line, pos, end, lo = HL_NONE, hi = 0;
+    int waiting = 0, state;
+    if (E.hl.syntax == NULL) return 0;
+    pos = docLineStart(first);
+    for (line = first; line < last && pos != DOC_NOLINE; line++) {
+        end = docLineEnd(pos);
+        if (hlRowFor(line, end - pos) == NULL) { // lines lo..hi lack a highlight
+            if (lo == HL_NONE) lo = line;
+            hi = line;
+            waiting++;
+        }
+        pos = end < docLength() ? end + 1 : DOC_NOLINE;
+    }
+    if (waiting && !E.hl.busy[HL_JOB_ROWS]) { // else asked for once the job in flight is back
+        struct hlJob *j = hlJobStart(HL_JOB_ROWS, lo);
+        pos = docLineStart(lo);
+        for (line = lo; line <= hi; line++) {
+            end = docLineEnd(pos);
+            hlEntry(line, &state);
+            hlJobAdd(j, pos, end - pos > HL_MAX_LINE ? HL_NONE :
+                     end - pos > hlRowBytes() ? hlRowBytes() : end - pos, state);
+            pos = end + 1;
+        }
+        hlPush(j);
+    }
+    hlContinue();
+    return waiting;
+}
+
+int hlIdle(void) {                          // nothing with the worker
+    return !E.hl.busy[HL_JOB_ROWS] && !E.hl.busy[HL_JOB_STATES];
+}
+
+/*** Trigram Index ***/
+/* Files of TRI_MIN bytes or more get an index of which TRI_BLOCK byte
+   blocks hold each trigram, hashed into TRI_BUCKETS posting lists. A
+   search looks up the trigrams of its query, or of the longest literal
+   every match of a regex contains, and scans only the blocks where a
+   match could start: those holding each trigram, or followed by a block
+   that does when a match could run into it. Each stretch of such blocks
+   is widened back to the start of its first line, as a count chunk is.
+
+   Building is opt-in, since it writes next to the user's file: with
+   KILO_INDEX=1 a background thread builds the index from the mapped file
+   and writes it beside it as .<name>.kidx. Any open maps an existing one
+   if the file's size, mtime and a hash of TRI_SAMPLES pages spread over it
+   still agree, so reopening a huge file searches at once, without reading
+   it through. KILO_INDEX=0 ignores index files altogether.
+
+   Edits never rebuild it. The blocks keep their offsets in the document,
+   moved along by each insert and delete, and the trigrams an edit makes
+   are added to their block in a hash set. Trigrams it destroys stay
+   listed, which only costs a block scanned for nothing. A block given more
+   than TRI_DIRTY trigrams by edits is scanned for every query. */
+#define TRI_MIN (64 << 20)                  // smaller files are searched without an index
+#define TRI_BLOCK (1 << 20)                 // bytes per block
+#define TRI_BITS 20                         // trigrams hash into 1 << TRI_BITS posting lists
+#define TRI_BUCKETS (1 << TRI_BITS)
+#define TRI_DIRTY 4096                      // trigrams edits add to a block before it is always scanned
+#define TRI_GRAMS 32                        // query trigrams looked up
+#define TRI_SAMPLES 64                      // 4 KB pages hashed to recognise the file
+#define TRI_LINE (1024 * 1024)              // how far back a stretch's first line start is looked for
+#define TRI_MAGIC "kilotri1"
+
+struct triHeader {                          // an index file, then TRI_BUCKETS + 1 offsets and the postings
+    char magic[8];
+    uint64_t len, mtime, hash;              // the file it was built from
+    uint64_t block, buckets;
+};
+
+struct triPost {                            // a posting list being built
+    unsigned char *p;                       // varint pairs: blocks skipped, then blocks in a row
+    uint32_t len, cap;
+    uint32_t end;                           // block after the last run written
+    uint32_t next, run;                     // the open run: run blocks, ending before next
+};
+
+struct triIndex {
+    char *path;                             // the index file
+    const unsigned char *data;              // header, offsets and postings, NULL until loaded or built
+    size_t datalen;
+    int mapped;                             // data maps the index file, else it is malloc'd
+    size_t *start;                          // document offset of each block, then the document length
+    size_t numblocks;                       // 0 when the document has no index
+    unsigned *added;                        // trigrams edits added to each block
+    uint64_t *extra;                        // (bucket << 32 | block) + 1 added by edits, 0 for empty slots
+    size_t numextra, capextra;
+    size_t *ranges;                         // [from, to) pairs found by triNarrow()
+    size_t numranges, capranges;
+    const char *base;                       // the mapped file, read by the builder
+    size_t len;
+    uint64_t mtime, hash;                   // recognise the file
+    pthread_t builder;
+    int building;                           // builder started and not joined yet
+    int stop, done;                         // builder asked to stop, finished: atomic
+    unsigned char *built;                   // the builder's result
+    size_t builtlen;
+    int notifyfd;                           // written when the build is done, -1 for none
+};
+
+struct triIndex TI = {.notifyfd = -1};
+
+unsigned triBucket(const unsigned char *p) { // posting list of the trigram at p
+    uint32_t t = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+    return (t * 2654435761u) >> (32 - TRI_BITS);
+}
+
+uint64_t triSample(const char *p, size_t len) { // FNV-1a of the length and pages spread over the file
+    uint64_t h = 14695981039346656037ULL ^ len;
+    size_t k, i;
+    for (k = 0; k < TRI_SAMPLES; k++) {
+        size_t off = len > 4096 ? (len - 4096) / (TRI_SAMPLES - 1) * k : 0, n = len - off < 4096 ? len - off : 4096;
+        for (i = 0; i < n; i++) h = (h ^ (unsigned char)p[off + i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+const unsigned char *triVarint(const unsigned char *p, const unsigned char *end, size_t *v) { // decode, NULL past end
+    int shift = 0;
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (size_t)(*p & 127) << shift;
+        if (!(*p++ & 128)) return p;
+        shift += 7;
+    }
+    return NULL;
+}
+
+void triPostWrite(struct triPost *t) {     // builder: close the open run
+    size_t v[2] = {t->next - t->run - t->end, t->run};
+    int i;
+    if (t->run == 0) return;
+    if (t->len + 20 > t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 16;
+        t->p = realloc(t->p, t->cap);
+        if (t->p == NULL) die("realloc");
+    }
+    for (i = 0; i < 2; i++) {
+        while (v[i] >= 128) {
+            t->p[t->len++] = v[i] | 128;
+            v[i] >>= 7;
+        }
+        t->p[t->len++] = v[i];
+    }
+    t->end = t->next;
+    t->run = 0;
+}
+
+void triPostAdd(struct triPost *t, uint32_t b) { // builder: block b has the trigram, b ascending
+    if (t->run && t->next == b) {
+        t->run++;
+    } else {
+        triPostWrite(t);
+        t->run = 1;
+    }
+    t->next = b + 1;
+}
+
+void triSave(const unsigned char *data, size_t len) { // write the index beside the file, if we may
+    char tmp[4096];
+    size_t done = 0;
+    ssize_t n;
+    int fd;
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", TI.path, (int)getpid()) >= (int)sizeof(tmp)) return;
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1) return;
+    while (done < len && (n = write(fd, data + done, len - done)) > 0) done += n;
+    if (close(fd) == -1 || done < len || rename(tmp, TI.path) == -1) unlink(tmp); // readers see all of it or none
+}
+
+void *triBuilder(void *arg) {               // background: index the mapped file and save it
+    struct triPost *post = calloc(TRI_BUCKETS, sizeof(struct triPost));
+    unsigned char *seen = calloc(TRI_BUCKETS / 8, 1);
+    uint32_t *fresh = malloc(sizeof(uint32_t) * TRI_BUCKETS); // buckets first met in this block
+    size_t b, i, k, n, total = 0;
+    (void)arg;
+    if (post == NULL || seen == NULL || fresh == NULL) die("malloc");
+    for (b = 0; b * TRI_BLOCK + 2 < TI.len; b++) {
+        size_t end = TI.len - 2 - b * TRI_BLOCK < TRI_BLOCK ? TI.len - 2 : (b + 1) * TRI_BLOCK;
+        if (__atomic_load_n(&TI.stop, __ATOMIC_RELAXED)) break;
+        for (i = b * TRI_BLOCK, n = 0; i < end; i++) {
+            k = triBucket((const unsigned char *)TI.base + i);
+            if (seen[k >> 3] & (1 << (k & 7))) continue;
+            seen[k >> 3] |= 1 << (k & 7);
+            fresh[n++] = k;
+        }
+        for (i = 0; i < n; i++) {
+            triPostAdd(&post[fresh[i]], b);
+            seen[fresh[i] >> 3] &= ~(1 << (fresh[i] & 7));
+        }
+    }
+    if (!__atomic_load_n(&TI.stop, __ATOMIC_RELAXED)) { // header, offsets, then every list in order
+        size_t head = sizeof(struct triHeader) + sizeof(uint64_t) * (TRI_BUCKETS + 1);
+        for (k = 0; k < TRI_BUCKETS; k++) {
+            triPostWrite(&post[k]);
+            total += post[k].len;
+        }
+        unsigned char *data = malloc(head + total);
+        if (data == NULL) die("malloc");
+        struct triHeader h = {TRI_MAGIC, TI.len, TI.mtime, TI.hash, TRI_BLOCK, TRI_BUCKETS};
+        uint64_t off = 0;
+        memcpy(data, &h, sizeof(h));
+        for (k = 0; k <= TRI_BUCKETS; k++) {
+            memcpy(data + sizeof(h) + sizeof(uint64_t) * k, &off, sizeof(off));
+            if (k == TRI_BUCKETS) break;
+            if (post[k].len) memcpy(data + head + off, post[k].p, post[k].len);
+            off += post[k].len;
+        }
+        triSave(data, head + total);
+        TI.built = data;
+        TI.builtlen = head + total;
+    }
+    for (k = 0; k < TRI_BUCKETS; k++) free(post[k].p);
+    free(post);
+    free(seen);
+    free(fresh);
+    __atomic_store_n(&TI.done, 1, __ATOMIC_RELEASE);
+    if (TI.notifyfd != -1) write(TI.notifyfd, "x", 1); // a full pipe is wakeup enough
+    return NULL;
+}
+
+int triValid(const unsigned char *data, size_t len) { // an index of the open file, sound to decode
+    struct triHeader h;
+    size_t head = sizeof(h) + sizeof(uint64_t) * (TRI_BUCKETS + 1), k;
+    uint64_t off, last = 0;
+    if (len < head) return 0;
+    memcpy(&h, data, sizeof(h));
+    if (memcmp(h.magic, TRI_MAGIC, 8) || h.len != TI.len || h.mtime != TI.mtime || h.hash != TI.hash ||
+        h.block != TRI_BLOCK || h.buckets != TRI_BUCKETS) return 0;
+    for (k = 0; k <= TRI_BUCKETS; k++) {    // offsets ascending and inside the file
+        memcpy(&off, data + sizeof(h) + sizeof(uint64_t) * k, sizeof(off));
+        if (off < last || off > len - head) return 0;
+        last = off;
+    }
+    return 1;
+}
+
+int triLoad(void) {                         // map the index file, 0 if there is no good one
+    struct stat st;
+    void *map;
+    int fd = open(TI.path, O_RDONLY);
+    if (fd == -1) return 0;
+    if (fstat(fd, &st) == -1 || st.st_size == 0 ||
+        (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    if (!triValid(map, st.st_size)) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+    TI.data = map;
+    TI.datalen = st.st_size;
+    TI.mapped = 1;
+    return 1;
+}
+
+void triClose(void) {                       // drop the document's index, stopping the builder
+    if (TI.building) {
+        __atomic_store_n(&TI.stop, 1, __ATOMIC_RELAXED);
+        pthread_join(TI.builder, NULL);
+        free(TI.built);
+    }
+    if (TI.mapped) munmap((void *)TI.data, TI.datalen);
+    else free((void *)TI.data);
+    free(TI.path);
+    free(TI.start);
+    free(TI.added);
+    free(TI.extra);
+    TI.path = NULL;
+    TI.data = NULL;
+    TI.built = NULL;
+    TI.start = NULL;
+    TI.added = NULL;
+    TI.extra = NULL;
+    TI.numblocks = TI.numextra = TI.capextra = 0;
+    TI.building = TI.stop = TI.done = TI.mapped = 0;
+}
+
+void triOpen(const char *filename, const char *map, size_t len, const struct stat *st, int notifyfd) {
+    const char *slash = strrchr(filename, '/'); // index a file just opened, or find its index
+    int dir = slash ? (int)(slash - filename) + 1 : 0;
+    const char *env = getenv("KILO_INDEX"); // unset: use an index that is there, 1: build one, 0: neither
+    size_t b;
+    triClose();
+    if (len < TRI_MIN || (env && atoi(env) == 0)) return;
+    TI.path = malloc(strlen(filename) + 7);
+    TI.numblocks = (len + TRI_BLOCK - 1) / TRI_BLOCK;
+    TI.start = malloc(sizeof(size_t) * (TI.numblocks + 1));
+    TI.added = calloc(TI.numblocks, sizeof(unsigned));
+    if (TI.path == NULL || TI.start == NULL || TI.added == NULL) die("malloc");
+    sprintf(TI.path, "%.*s.%s.kidx", dir, filename, filename + dir);
+    for (b = 0; b < TI.numblocks; b++) TI.start[b] = b * TRI_BLOCK;
+    TI.start[TI.numblocks] = len;
+    TI.base = map;
+    TI.len = len;
+    TI.mtime = STAT_MTIME_NS(st);
+    TI.hash = triSample(map, len);
+    TI.notifyfd = notifyfd;
+    if (!triLoad() && env && atoi(env) == 1 && pthread_create(&TI.builder, NULL, triBuilder, NULL) == 0)
+        TI.building = 1;
+    if (TI.data == NULL && !TI.building) triClose(); // no index: edits need not track blocks
+}
+
+void triCollect(void) {                     // take the index the builder finished
+    if (!TI.building || !__atomic_load_n(&TI.done, __ATOMIC_ACQUIRE)) return;
+    pthread_join(TI.builder, NULL);
+    TI.building = 0;
+    TI.data = TI.built;
+    TI.datalen = TI.builtlen;
+    TI.built = NULL;
+}
+
+size_t triBlockOf(size_t pos) {             // last block starting at or before pos
+    size_t lo = 0, hi = TI.numblocks;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (TI.start[mid] <= pos) lo = mid;
+        else hi = mid;
+    }
+    return lo;
+}
+
+uint64_t triSlot(uint64_t key, size_t cap) { // where a key's probe sequence starts
+    return (key * 0x9e3779b97f4a7c15ULL) >> 17 & (cap - 1);
+}
+
+void triAdd(unsigned bucket, size_t b) {    // an edit put a trigram into block b
+    uint64_t key = ((uint64_t)bucket << 32 | b) + 1, i;
+    size_t k;
+    if (TI.added[b] > TRI_DIRTY) return;    // scanned anyway
+    if (2 * (TI.numextra + 1) > TI.capextra) { // rehash at half full
+        uint64_t *old = TI.extra;
+        size_t cap = TI.capextra;
+        TI.capextra = cap ? cap * 2 : 1024;
+        TI.extra = calloc(TI.capextra, sizeof(uint64_t));
+        if (TI.extra == NULL) die("calloc");
+        for (k = 0; k < cap; k++) {
+            if (!old[k]) continue;
+            for (i = triSlot(old[k], TI.capextra); TI.extra[i]; i = (i + 1) & (TI.capextra - 1));
+            TI.extra[i] = old[k];
+        }
+        free(old);
+    }
+    for (i = triSlot(key, TI.capextra); TI.extra[i]; i = (i + 1) & (TI.capextra - 1))
+        if (TI.extra[i] == key) return;
+    TI.extra[i] = key;
+    TI.numextra++;
+    TI.added[b]++;
+}
+
+void triEdited(size_t lo, size_t hi) {      // trigrams starting in [lo, hi) may be new
+    unsigned char buf[4096 + 2];
+    size_t len = docLength(), b = triBlockOf(lo), i, n;
+    if (len < 3) return;
+    if (hi > len - 2) hi = len - 2;
+    while (lo < hi) {
+        while (b + 1 < TI.numblocks && TI.start[b + 1] <= lo) b++;
+        if (TI.added[b] > TRI_DIRTY) {      // skip the rest of a dirty block
+            lo = TI.start[b + 1];
+            continue;
+        }
+        n = hi - lo < 4096 ? hi - lo : 4096;
+        if (n > TI.start[b + 1] - lo) n = TI.start[b + 1] - lo; // one block at a time
+        docRead(lo, (char *)buf, n + 2);
+        for (i = 0; i < n; i++) triAdd(triBucket(buf + i), b);
+        lo += n;
+    }
+}
+
+void triInserted(size_t pos, size_t len) {  // len bytes were inserted at pos
+    size_t b;
+    if (TI.numblocks == 0) return;
+    for (b = triBlockOf(pos) + 1; b <= TI.numblocks; b++) TI.start[b] += len; // they join pos's block
+    triEdited(pos < 2 ? 0 : pos - 2, pos + len);
+}
+
+void triDeleted(size_t pos, size_t len) {   // len bytes at pos were deleted
+    size_t b;
+    if (TI.numblocks == 0) return;
+    for (b = triBlockOf(pos) + 1; b <= TI.numblocks; b++) // blocks inside the range become empty
+        TI.start[b] = TI.start[b] - pos > len ? TI.start[b] - len : pos;
+    triEdited(pos < 2 ? 0 : pos - 2, pos); // the trigrams across the join
+}
+
+void triPostings(unsigned bucket, unsigned char *has) { // mark the blocks a bucket lists
+    const unsigned char *dir = TI.data + sizeof(struct triHeader), *p, *end;
+    size_t head = sizeof(struct triHeader) + sizeof(uint64_t) * (TRI_BUCKETS + 1), b = 0, gap, run, k;
+    uint64_t from, to;
+    memcpy(&from, dir + sizeof(uint64_t) * bucket, sizeof(from));
+    memcpy(&to, dir + sizeof(uint64_t) * (bucket + 1), sizeof(to));
+    p = TI.data + head + from;
+    end = TI.data + head + to;
+    while ((p = triVarint(p, end, &gap)) != NULL && (p = triVarint(p, end, &run)) != NULL) {
+        for (b += gap, k = 0; k < run && b < TI.numblocks; k++) has[b++] = 1;
+    }
+    for (k = 0; k < TI.capextra; k++)       // and the edits
+        if (TI.extra[k] && (TI.extra[k] - 1) >> 32 == bucket) has[(TI.extra[k] - 1) & 0xffffffff] = 1;
+}
+
+size_t triLineStart(size_t pos) {           // start of pos's line, at most TRI_LINE back
+    char buf[4096];
+    size_t lo = pos > TRI_LINE ? pos - TRI_LINE : 0, n;
+    while (pos > lo) {
+        n = pos - lo < sizeof(buf) ? pos - lo : sizeof(buf);
+        docRead(pos - n, buf, n);
+        const char *nl = nlLast(buf, n);
+        if (nl) return pos - n + (nl - buf) + 1;
+        pos -= n;
+    }
+    return lo;
+}
+
+void triRange(size_t from, size_t to) {     // add to the ranges, joining one that touches the last
+    if (from >= to) return;
+    if (TI.numranges && from <= TI.ranges[2 * TI.numranges - 1]) {
+        if (to > TI.ranges[2 * TI.numranges - 1]) TI.ranges[2 * TI.numranges - 1] = to;
+        return;
+    }
+    if (TI.numranges == TI.capranges) {
+        TI.capranges = TI.capranges ? TI.capranges * 2 : 16;
+        TI.ranges = realloc(TI.ranges, sizeof(size_t) * 2 * TI.capranges);
+        if (TI.ranges == NULL) die("realloc");
+    }
+    TI.ranges[2 * TI.numranges] = from;
+    TI.ranges[2 * TI.numranges + 1] = to;
+    TI.numranges++;
+}
+
+size_t triNarrow(const char *s, size_t n, int regex, size_t from, size_t to) { // TI.ranges: where matches
+    unsigned grams[TRI_GRAMS];              // in [from, to) may start, in order
+    size_t numgrams = 0, nb = TI.numblocks, b, e, i, k, r, next;
+    TI.numranges = 0;
+    if (regex) {                            // a regex's matches contain its literal
+        struct regex *re = reGet(s, n);
+        s = re ? re->lit : NULL;
+        n = re ? re->litlen : 0;
+    }
+    if (TI.data == NULL || n < 3) {         // nothing to narrow with
+        triRange(from, to);
+        return TI.numranges;
+    }
+    for (i = 0; i + 3 <= n && numgrams < TRI_GRAMS; i++) {
+        unsigned g = triBucket((const unsigned char *)s + i);
+        for (k = 0; k < numgrams && grams[k] != g; k++);
+        if (k == numgrams) grams[numgrams++] = g;
+    }
+    unsigned char *cand = malloc(nb), *has = malloc(nb);
+    size_t *reach = malloc(sizeof(size_t) * nb); // last block a trigram of a match starting in b starts in
+    if (cand == NULL || has == NULL || reach == NULL) die("malloc");
+    for (b = r = 0; b < nb; b++) {
+        cand[b] = TI.start[b] < TI.start[b + 1] && TI.start[b + 1] > from && TI.start[b] < to;
+        if (r < b) r = b;
+        while (r + 1 < nb && TI.start[r + 1] + 3 < TI.start[b + 1] + n) r++;
+        reach[b] = r;
+    }
+    for (k = 0; k < numgrams; k++) {        // every trigram, in b or a block it runs into
+        memset(has, 0, nb);
+        triPostings(grams[k], has);
+        for (b = nb, next = nb; b-- > 0;) {
+            if (has[b] || TI.added[b] > TRI_DIRTY) next = b;
+            if (next > reach[b]) cand[b] = 0;
+        }
+    }
+    for (b = 0; b < nb; b = e + 1) {        // stretches of candidates, from their first line's start
+        if (!cand[e = b]) continue;
+        while (e + 1 < nb && cand[e + 1]) e++;
+        size_t lo = triLineStart(TI.start[b]), hi = TI.start[e + 1];
+        triRange(lo > from ? lo : from, hi < to ? hi : to);
+    }
+    free(cand);
+    free(has);
+    free(reach);
+    return TI.numranges;
+}
+
+/*** Editor Operations ***/
+
+int editorByteAt(size_t pos) {             // document byte, -1 past the end
+    unsigned char c;
+    return docRead(pos, (char *)&c, 1) ? c : -1;
+}
+
+size_t editorLineLen(size_t line) {        // bytes in a line, excluding '\n'
+    size_t start = docLineStart(line);
+    return docLineEnd(start) - start;
+}
+
+int editorLineExists(size_t line) {        // line is inside the document
+    return docLineStart(line) != DOC_NOLINE;
+}
+
+size_t editorRowCxToRx(size_t line, size_t cx) { // byte offset to render column
+    size_t pos = docLineStart(line), end = pos + cx, rx = 0, n, j;
+    const char *p;
+    while (pos < end && (p = docSpan(pos, &n)) != NULL) {
+        if (n > end - pos) n = end - pos;
+        for (j = 0; j < n; j++) {
+            if (p[j] == '\t') rx += KILO_TAB_STOP - (rx % KILO_TAB_STOP);
+            else if (!isUtf8Cont((unsigned char)p[j])) rx++;
+        }
+        pos += n;
+    }
+    return rx;
+}
+
+int utf8Encode(int cp, char *out) {         // codepoint to UTF-8, returns length
+    if (cp < 0x80) { out[0] = cp; return 1; }
+    if (cp < 0x800) { out[0] = 0xc0 | (cp >> 6); out[1] = 0x80 | (cp & 0x3f); return 2; }
+    if (cp < 0x10000) {
+        out[0] = 0xe0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3f);
+        out[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+    out[0] = 0xf0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3f);
+    out[2] = 0x80 | ((cp >> 6) & 0x3f);
+    out[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+void editorInsertChar(int cp) {            // insert a character at the cursor
+    char buf[4];
+    int len = utf8Encode(cp, buf);
+    size_t pos = docLineStart(E.cy) + E.cx;
+    docInsert(pos, buf, len);
+    triInserted(pos, len);
+    hlEditLine(E.cy);
+    E.cx += len;
+}
+
+void editorInsertNewline(void) {           // split the line at the cursor
+    size_t pos = docLineStart(E.cy) + E.cx;
+    docInsert(pos, "\n", 1);
+    triInserted(pos, 1);
+    hlInsertLines(E.cy, 1);
+    E.cy++;
+    E.cx = 0;
+}
+
+void editorDelChar(void) {                 // delete the character left of the cursor
+    size_t pos = docLineStart(E.cy) + E.cx;
+    if (pos == 0) return;
+    if (E.cx == 0) {                       // join with the previous line
+        E.cy--;
+        E.cx = editorLineLen(E.cy);
+        docDelete(pos - 1, 1);
+        triDeleted(pos - 1, 1);
+        hlDeleteLines(E.cy, 1);
+        return;
+    }
+    size_t n = 1;
+    while (n < E.cx && isUtf8Cont(editorByteAt(pos - n))) n++; // whole UTF-8 sequence
+    docDelete(pos - n, n);
+    triDeleted(pos - n, n);
+    hlEditLine(E.cy);
+    E.cx -= n;
+}
+
+void editorPaste(void) {                   // bracketed paste: one insert, one redraw
+    size_t n, len = 0, i;
+    char *p = inputPaste(&n);
+    for (i = 0; i < n; i++) {               // terminals send line breaks as CR
+        char *cr = memchr(p + i, '\r', n - i);
+        size_t span = cr ? (size_t)(cr - p) - i : n - i;
+        memmove(p + len, p + i, span);
+        len += span;
+        i += span;
+        if (cr && (i + 1 == n || p[i + 1] != '\n')) p[len++] = '\n'; // CR LF keeps the LF
+    }
+    size_t pos = docLineStart(E.cy) + E.cx;
+    docInsert(pos, p, len);
+    triInserted(pos, len);
+    size_t lines = countNewlines(p, len);
+    if (lines > 0) hlInsertLines(E.cy, lines);
+    else hlEditLine(E.cy);
+    if (lines > 0) {                        // cursor ends after the last line break
+        E.cy += lines;
+        E.cx = p + len - nlLast(p, len) - 1;
+    } else {
+        E.cx += len;
+    }
+    free(p);
+}
+
+/*** Find ***/
+/* Ctrl-F opens a prompt in the status bar. Each key typed searches again
+   from where the cursor was, the arrows step to the next or previous
+   match, Enter stays there and Esc goes back. Ctrl-R switches between
+   plain text and regular expressions. A match may straddle the spans the
+   backend hands out, so the last needle-length bytes of one span are
+   searched again together with the start of the next. A regex search
+   streams the spans through the forward DFA to the first place a match
+   ends, then works out where that line's leftmost match begins and ends
+   from a copy of at most RE_WINDOW bytes either side. Every match in the
+   visible rows is drawn in ATTR_MATCH. */
+#define FIND_BLOCK (1024 * 1024)            // bytes per step of a backward search
+#define RE_WINDOW (1024 * 1024)             // bytes a regex match may reach back or on
+
+size_t docFind(const struct docView *v, const char *s, size_t n, size_t from, size_t to) { // first match starting in [from, to)
+    char carry[2 * FIND_MAX];               // tail of the spans before, then the next one's head
+    size_t k = 0, pos = from, len, stop = to + n - 1;
+    const char *p, *hit;
+    if (n == 0 || n > FIND_MAX || from >= to) return FIND_NONE;
+    while (pos < stop && (p = docViewSpan(v, pos, &len)) != NULL) {
+        if (len > stop - pos) len = stop - pos;
+        if (k) {                            // matches that start in the carried bytes
+            size_t m = len < n - 1 ? len : n - 1;
+            memcpy(carry + k, p, m);
+            if ((hit = findScan(carry, k + m, s, n)) != NULL && (size_t)(hit - carry) < k)
+                return pos - k + (hit - carry);
+        }
+        if ((hit = findScan(p, len, s, n)) != NULL) return pos + (hit - p);
+        if (len >= n - 1) {                 // carry the last n - 1 bytes seen
+            memcpy(carry, p + len - (n - 1), n - 1);
+            k = n - 1;
+        } else {
+            size_t keep = k < n - 1 - len ? k : n - 1 - len;
+            memmove(carry, carry + k - keep, keep);
+            memcpy(carry + keep, p, len);
+            k = keep + len;
+        }
+        pos += len;
+    }
+    return FIND_NONE;
+}
+
+size_t docFindLast(const struct docView *v, const char *s, size_t n, size_t from, size_t to) { // last match starting in [from, to)
+    while (to > from) {                     // one block at a time, back from the end
+        size_t start = to - from > FIND_BLOCK ? to - FIND_BLOCK : from, at = start, hit, last = FIND_NONE;
+        while ((hit = docFind(v, s, n, at, to)) != FIND_NONE) {
+            last = hit;
+            at = hit + 1;
+        }
+        if (last != FIND_NONE) return last;
+        to = start;
+    }
+    return FIND_NONE;
+}
+
+int docViewLineStarts(const struct docView *v, size_t pos) { // pos is at the start of a line
+    char c;
+    return pos == 0 || (docViewRead(v, pos - 1, &c, 1) && c == '\n');
+}
+
+size_t docRegexFind(const struct docView *v, struct regex *re, size_t from, size_t to, size_t *end) { // first match starting in [from, to)
+    struct reRun r;
+    size_t pos = from, ls = from, e = FIND_NONE, n, i, s, len = docViewLength(v);
+    const char *p = NULL;
+    if (from >= to) return FIND_NONE;
+    re->dfa[RE_FORWARD].flushes = 0;
+    reRunInit(&r, re, RE_FORWARD);
+    if (docViewLineStarts(v, from)) reRunStep(&r, RE_BOL(re));
+    if (r.accept) e = from;
+    while (e == FIND_NONE && (p = docViewSpan(v, pos, &n)) != NULL) { // to where the first match ends
+        for (i = 0; i < n; i++) {
+            size_t k = reRunFast(&r, p + i, pos + i >= to ? 0 : to - pos - i < n - i ? to - pos - i : n - i);
+            if (k) {                        // it runs across lines up to to
+                const char *nl = nlLast(p + i, k);
+                if (nl) ls = pos + (nl - p) + 1;
+                if ((i += k) == n) break;
+            }
+            if (p[i] != '\n') {
+                reRunStep(&r, re->byteclass[(unsigned char)p[i]]);
+                if (r.accept) e = pos + i + 1;
+            } else if (reRunNewline(&r)) {  // end one line, start the next
+                e = pos + i;
+            } else if (pos + i >= to) {
+                break;
+            } else {
+                ls = pos + i + 1;
+                if (r.accept) e = ls;
+            }
+            if (e != FIND_NONE) break;
+        }
+        if (i < n) break;                   // past to, or found
+        pos += n;
+    }
+    if (e == FIND_NONE && p == NULL) {      // the last line has no '\n'
+        reRunStep(&r, RE_EOL(re));
+        if (r.accept) e = len;
+    }
+    reRunFree(&r);
+    if (e == FIND_NONE) return FIND_NONE;
+
+    size_t le = docViewLineEnd(v, e);       // the matching line, around e
+    size_t lo = e - ls > RE_WINDOW ? e - RE_WINDOW : ls, hi = le - e > RE_WINDOW ? e + RE_WINDOW : le;
+    char *buf = malloc(hi - lo + 1);
+    if (buf == NULL) die("malloc");
+    docViewRead(v, lo, buf, hi - lo);
+    int found = reSearch(re, buf, hi - lo, docViewLineStarts(v, lo), hi == le, &s, end);
+    free(buf);
+    if (!found || lo + s >= to) return FIND_NONE;
+    *end += lo;
+    return lo + s;
+}
+
+size_t docRegexFindLast(const struct docView *v, struct regex *re, size_t from, size_t to, size_t *end) { // last match starting in [from, to)
+    while (to > from) {
+        size_t start = from, at, hit, e, last = FIND_NONE;
+        if (to - from > FIND_BLOCK) {       // blocks begin at line starts, so the matches
+            start = docViewLineEnd(v, to - FIND_BLOCK) + 1; // found are the ones marked on screen
+            if (start >= to) start = to - FIND_BLOCK; // inside one long line
+        }
+        at = start;
+        while ((hit = docRegexFind(v, re, at, to, &e)) != FIND_NONE) {
+            last = hit;
+            *end = e;
+            at = e > hit ? e : hit + 1;
+        }
+        if (last != FIND_NONE) return last;
+        to = start;
+    }
+    return FIND_NONE;
+}
+
+/*** Parallel Search ***/
+/* Documents of SEARCH_MIN bytes or more are searched by a pool of threads,
+   one per CPU unless KILO_THREADS says otherwise. A search is cut into
+   SEARCH_CHUNK byte ranges handed out in order. Each worker finds the
+   matches that start in its range, reading past the end as far as one can
+   reach, so a match across a boundary is found once. The main thread takes
+   the results back in order and stops handing out chunks as soon as one
+   has a match, so the first match shows without waiting for the rest.
+
+   While the prompt is open the pool also counts every match in the
+   document, in chunks that begin at line starts so each chunk's count is
+   what a scan of the whole document would find there; first-match chunks
+   go ahead of them. The status bar shows the matches of the chunks done
+   so far in order. A plain-text count also keeps where every occurrence
+   is, up to FIND_SET_MAX of them, for the prompt to narrow down as the
+   query grows. Workers read a docView, and each compiles its own copy of
+   a regex since the lazy DFA is filled in as it runs. */
+#define SEARCH_MIN (32 << 20)               // smaller documents are searched on the main thread
+#define SEARCH_CHUNK (1 << 20)              // bytes per piece of work
+#define SEARCH_MAX_THREADS 64
+
+enum searchKind { SEARCH_FIRST, SEARCH_COUNT }; // jobs, in the order workers take them
+
+struct searchChunk {                        // one range of a job
+    size_t from, to;                        // matches starting in [from, to)
+    size_t hit, hitend;                     // first match, the last one going backward, FIND_NONE if none
+    size_t count;                           // matches, SEARCH_COUNT only
+    size_t *hits, numhits, caphits;         // every occurrence, recording jobs only
+    int done;                               // the results are in
+};
+
+struct searchJob {                          // one search cut into chunks
+    char query[FIND_MAX];
+    size_t len;
+    int regex;
+    int backward;                           // chunks from the end, each after its last match
+    unsigned long version;                  // E.docversion searched
+    struct searchChunk *chunks;
+    size_t numchunks, cap;
+    size_t next;                            // chunks handed out
+    size_t need;                            // chunks worth handing out
+    int busy;                               // chunks being searched
+    int record;                             // keep each chunk's occurrences
+    size_t recorded;                        // occurrences kept by finished chunks, atomic
+    int overflow;                           // more than FIND_SET_MAX: none are kept, atomic
+};
+
+struct searchPool {
+    pthread_t threads[SEARCH_MAX_THREADS];
+    int numthreads;
+    pthread_mutex_t lock;                   // guards the jobs and quit
+    pthread_cond_t work;                    // chunks to hand out, or quit
+    pthread_cond_t done;                    // a chunk was finished
+    struct searchJob jobs[2];               // by searchKind
+    struct docView view;                    // what the workers read, only replaced while they are idle
+    int quit;
+    int notifyfd;                           // written as counted chunks finish, -1 for none
+};
+
+struct searchPool SP = {.lock = PTHREAD_MUTEX_INITIALIZER, .work = PTHREAD_COND_INITIALIZER,
+                        .done = PTHREAD_COND_INITIALIZER, .notifyfd = -1};
+
+void searchRecord(struct searchJob *j, struct searchChunk *c, size_t hit) { // worker: keep an occurrence
+    if (__atomic_load_n(&j->overflow, __ATOMIC_RELAXED)) return;
+    if (c->numhits + __atomic_load_n(&j->recorded, __ATOMIC_RELAXED) >= FIND_SET_MAX) {
+        __atomic_store_n(&j->overflow, 1, __ATOMIC_RELAXED); // too many to be worth keeping
+        return;
+    }
+    if (c->numhits == c->caphits) {
+        c->caphits = c->caphits ? c->caphits * 2 : 256;
+        c->hits = realloc(c->hits, sizeof(size_t) * c->caphits);
+        if (c->hits == NULL) die("realloc");
+    }
+    c->hits[c->numhits++] = hit;
+}
+
+void searchChunkRun(struct searchJob *j, struct searchChunk *c, int kind, struct regex **re) { // worker: one chunk
+    const struct docView *v = &SP.view;
+    size_t at = c->from, hit, end, last = c->from;
+    c->hit = FIND_NONE;
+    c->count = 0;
+    if (j->regex && (*re == NULL || (*re)->patlen != j->len || memcmp((*re)->pattern, j->query, j->len))) {
+        reFree(*re);                        // compiled before on the main thread, so it compiles
+        *re = reNew(j->query, j->len);
+    }
+    if (j->regex && *re == NULL) return;
+    if (kind == SEARCH_FIRST && j->backward) {
+        if (j->regex) c->hit = docRegexFindLast(v, *re, c->from, c->to, &c->hitend);
+        else if ((c->hit = docFindLast(v, j->query, j->len, c->from, c->to)) != FIND_NONE) c->hitend = c->hit + j->len;
+        return;
+    }
+    while (at < c->to) {
+        if (j->regex) hit = docRegexFind(v, *re, at, c->to, &end);
+        else if ((hit = docFind(v, j->query, j->len, at, c->to)) != FIND_NONE) end = hit + j->len;
+        if (hit == FIND_NONE) break;
+        if (c->hit == FIND_NONE) {
+            c->hit = hit;
+            c->hitend = end;
+        }
+        if (kind == SEARCH_FIRST) break;
+        if (hit >= last) {                  // the matches editorFindRow() marks
+            c->count++;
+            last = end > hit ? end : hit + 1;
+        }
+        if (j->regex) {
+            at = last;
+        } else {                            // text: every occurrence, overlapping ones too
+            if (j->record) searchRecord(j, c, hit);
+            at = hit + 1;
+        }
+    }
+}
+
+void *searchWorker(void *arg) {             // a pool thread
+    struct regex *re = NULL;                // this thread's copy of a regex query
+    (void)arg;
+    pthread_mutex_lock(&SP.lock);
+    while (!SP.quit) {
+        int kind = SEARCH_FIRST;
+        struct searchJob *j = &SP.jobs[kind];
+        if (j->next == j->need) j = &SP.jobs[kind = SEARCH_COUNT];
+        if (j->next == j->need) {
+            pthread_cond_wait(&SP.work, &SP.lock);
+            continue;
+        }
+        size_t k = j->next++;
+        struct searchChunk *c = &j->chunks[j->backward ? j->numchunks - 1 - k : k];
+        j->busy++;
+        pthread_mutex_unlock(&SP.lock);
+        searchChunkRun(j, c, kind, &re);
+        pthread_mutex_lock(&SP.lock);
+        if (j->record) __atomic_add_fetch(&j->recorded, c->numhits, __ATOMIC_RELAXED);
+        c->done = 1;
+        j->busy--;
+        pthread_cond_broadcast(&SP.done);
+        if (kind == SEARCH_COUNT && SP.notifyfd != -1)
+            write(SP.notifyfd, "s", 1);     // a full pipe is wakeup enough
+    }
+    pthread_mutex_unlock(&SP.lock);
+    reFree(re);
+    return NULL;
+}
+
+void searchCancel(int kind) {               // hand out no more of a job, wait for the chunks out
+    struct searchJob *j = &SP.jobs[kind];
+    pthread_mutex_lock(&SP.lock);
+    j->need = j->next;
+    while (j->busy) pthread_cond_wait(&SP.done, &SP.lock);
+    pthread_mutex_unlock(&SP.lock);
+}
+
+void searchCut(struct searchJob *j, size_t from, size_t to, int lines) { // chunks of [from, to), at line starts if lines
+    while (from < to) {
+        size_t end = to - from > SEARCH_CHUNK ? from + SEARCH_CHUNK : to;
+        if (lines && end < to && (end = docViewLineEnd(&SP.view, end - 1) + 1) > to) end = to;
+        if (j->numchunks == j->cap) {
+            j->cap = j->cap ? j->cap * 2 : 64;
+            j->chunks = realloc(j->chunks, sizeof(struct searchChunk) * j->cap);
+            if (j->chunks == NULL) die("realloc");
+        }
+        j->chunks[j->numchunks++] = (struct searchChunk){from, end, FIND_NONE, 0, 0, NULL, 0, 0, 0};
+        from = end;
+    }
+}
+
+void searchSubmit(int kind, const char *s, size_t n, int regex, int backward, size_t from, size_t to) {
+    struct searchJob *j = &SP.jobs[kind];   // replace a job and wake the pool
+    size_t k, numranges;
+    if (SP.view.version != E.docversion) {  // the document changed: nobody may be reading the old view
+        searchCancel(SEARCH_FIRST);
+        searchCancel(SEARCH_COUNT);
+        docViewTake(&SP.view);
+    }
+    searchCancel(kind);
+    memcpy(j->query, s, n);
+    j->len = n;
+    j->regex = regex;
+    j->backward = backward;
+    j->version = E.docversion;
+    j->record = kind == SEARCH_COUNT && !regex;
+    j->recorded = 0;
+    j->overflow = 0;
+    while (j->numchunks) free(j->chunks[--j->numchunks].hits);
+    numranges = triNarrow(s, n, regex, from, to); // only where the index allows a match
+    for (k = 0; k < numranges; k++)         // line starts, like docRegexFindLast()
+        searchCut(j, TI.ranges[2 * k], TI.ranges[2 * k + 1], kind == SEARCH_COUNT || backward);
+    pthread_mutex_lock(&SP.lock);
+    j->next = 0;
+    j->need = j->numchunks;
+    pthread_cond_broadcast(&SP.work);
+    pthread_mutex_unlock(&SP.lock);
+}
+
+size_t searchFirst(const char *s, size_t n, int regex, int backward, size_t from, size_t to, size_t *end) {
+    struct searchJob *j = &SP.jobs[SEARCH_FIRST]; // first match in [from, to), or the last one
+    size_t k, hit = FIND_NONE;
+    searchSubmit(SEARCH_FIRST, s, n, regex, backward, from, to);
+    pthread_mutex_lock(&SP.lock);
+    for (k = 0; k < j->numchunks && hit == FIND_NONE; k++) { // in the order they were handed out
+        struct searchChunk *c = &j->chunks[backward ? j->numchunks - 1 - k : k];
+        while (!c->done) pthread_cond_wait(&SP.done, &SP.lock);
+        hit = c->hit;
+        *end = c->hitend;
+    }
+    j->need = j->next;                      // the chunks after it are not needed
+    while (j->busy) pthread_cond_wait(&SP.done, &SP.lock);
+    pthread_mutex_unlock(&SP.lock);
+    return hit;
+}
+
+void searchCountStart(const char *s, size_t n, int regex) { // count the document's matches in the background
+    struct searchJob *j = &SP.jobs[SEARCH_COUNT];
+    if (SP.numthreads == 0) return;
+    if (j->version == E.docversion && j->len == n && j->regex == regex && memcmp(j->query, s, n) == 0 &&
+        j->need == j->numchunks) return;    // already counting it
+    searchSubmit(SEARCH_COUNT, s, n, regex, 0, 0, docLength());
+}
 
-/*** Terminal Control ***/
-void die(const char *s) {           // fatal error handler
-    write(STDOUT_FILENO, "\x1b[2J", 4);  // clear entire screen
-    write(STDOUT_FILENO, "\x1b[H", 3);   // move cursor to top-left
-    perror(s);                           // print error message
-    exit(1);                             // exit with failure
+size_t searchCounted(int wait, int *complete) { // matches in the chunks counted so far in order
+    struct searchJob *j = &SP.jobs[SEARCH_COUNT];
+    size_t k, n = 0;
+    pthread_mutex_lock(&SP.lock);
+    for (k = 0; k < j->numchunks; k++) {
+        while (wait && !j->chunks[k].done && k < j->need) pthread_cond_wait(&SP.done, &SP.lock);
+        if (!j->chunks[k].done) break;
+        n += j->chunks[k].count;
+    }
+    *complete = k == j->numchunks;
+    pthread_mutex_unlock(&SP.lock);
+    return n;
 }
 
-void disableRawMode(void) {          // restore terminal settings
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios); // reset terminal mode
+void findSetReserve(struct findSet *set, size_t n) { // room for n matches
+    if (n <= set->cap) return;
+    set->cap = n;
+    set->pos = realloc(set->pos, sizeof(size_t) * n);
+    if (set->pos == NULL) die("realloc");
 }
 
-void enableRawMode(void) {            // enable raw input mode
-    tcgetattr(STDIN_FILENO, &E.orig_termios); // save current terminal state
-    atexit(disableRawMode);                   // restore terminal on exit
+int searchTakeHits(const char *s, size_t n, struct findSet *set) { // a finished count's occurrences, 0 if none kept
+    struct searchJob *j = &SP.jobs[SEARCH_COUNT];
+    size_t k;
+    int ok;
+    pthread_mutex_lock(&SP.lock);
+    ok = j->record && !j->overflow && j->version == E.docversion && j->len == n && memcmp(j->query, s, n) == 0;
+    for (k = 0; ok && k < j->numchunks; k++) ok = j->chunks[k].done;
+    if (ok) {
+        set->n = set->matches = 0;
+        findSetReserve(set, j->recorded);
+        for (k = 0; k < j->numchunks; k++) {
+            if (j->chunks[k].numhits)
+                memcpy(set->pos + set->n, j->chunks[k].hits, sizeof(size_t) * j->chunks[k].numhits);
+            set->n += j->chunks[k].numhits;
+            set->matches += j->chunks[k].count;
+        }
+        set->valid = 1;
+    }
+    pthread_mutex_unlock(&SP.lock);
+    return ok;
+}
 
-    struct termios raw = E.orig_termios;      // copy terminal attributes
+void searchStop(void) {                     // join the pool
+    int i;
+    searchCancel(SEARCH_FIRST);
+    searchCancel(SEARCH_COUNT);
+    pthread_mutex_lock(&SP.lock);
+    SP.quit = 1;
+    pthread_cond_broadcast(&SP.work);
+    pthread_mutex_unlock(&SP.lock);
+    for (i = 0; i < SP.numthreads; i++) pthread_join(SP.threads[i], NULL);
+    SP.numthreads = 0;
+    SP.quit = 0;
+}
 
-    raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON); // disable input processing
-    raw.c_oflag &= ~(OPOST);                                 // disable output processing
-    raw.c_cflag |= (CS8);                                   // force 8-bit characters
-    raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);        // disable echo, canonical mode, signals
+void searchStart(int threads, int notifyfd) { // up to threads workers, as many as we can start
+    SP.notifyfd = notifyfd;
+    if (threads > SEARCH_MAX_THREADS) threads = SEARCH_MAX_THREADS;
+    while (SP.numthreads < threads && pthread_create(&SP.threads[SP.numthreads], NULL, searchWorker, NULL) == 0)
+        SP.numthreads++;
+}
 
-    raw.c_cc[VMIN] = 0;       // read() returns immediately
-    raw.c_cc[VTIME] = 1;      // read() waits up to 100ms
+/*** Find Prompt ***/
+size_t docCountLines(size_t from, size_t to) { // newlines in [from, to)
+    size_t n = 0, len;
+    const char *p;
+    while (from < to && (p = docSpan(from, &len)) != NULL) {
+        if (len > to - from) len = to - from;
+        n += countNewlines(p, len);
+        from += len;
+    }
+    return n;
+}
 
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw); // apply raw mode
+void editorFindRowBuffers(size_t n) {       // room for n bytes of a row
+    struct finder *f = &E.find;
+    if (n <= f->rowcap) return;
+    f->rowcap = n > 2 * f->rowcap ? n : 2 * f->rowcap;
+    f->rowtext = realloc(f->rowtext, f->rowcap);
+    f->rowattr = realloc(f->rowattr, f->rowcap);
+    if (f->rowtext == NULL || f->rowattr == NULL) die("realloc");
 }
 
-int editorReadKey(void) {
-  int nread;
-  char c;
-  while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-    if (nread == -1 && errno != EAGAIN) die("read");
-  }
-  if (c == '\x1b') {
-    char seq[3];
-    if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-    if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
-    if (seq[0] == '[') {
-      if (seq[1] >= '0' && seq[1] <= '9') {
-        if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
-        if (seq[2] == '~') {
-          switch (seq[1]) {
-            case '1': return HOME_KEY;
-            case '4': return END_KEY;
-            case '3': return DEL_KEY;
-            
-            case '5': return PAGE_UP;
-            case '6': return PAGE_DOWN;
-            case '7': return HOME_KEY;
-            case '8': return END_KEY;
-          }
-        }
-         } else if (seq[0] == 'O') {
-         switch (seq[1]) {
-        case 'H': return HOME_KEY;
-        case 'F': return END_KEY;
-      }
-      } else {
-        switch (seq[1]) {
-          case 'A': return ARROW_UP;
-          case 'B': return ARROW_DOWN;
-          case 'C': return ARROW_RIGHT;
-          case 'D': return ARROW_LEFT;
-          case 'H': return HOME_KEY;
-          case 'F': return END_KEY;
+void editorJumpTo(size_t pos) {             // put the cursor on a document offset
+    size_t start = docLineStart(E.cy);      // count lines from where the cursor is
+    if (pos >= start) E.cy += docCountLines(start, pos);
+    else E.cy -= docCountLines(pos, start);
+    E.cx = pos - docLineStart(E.cy);
+    if (E.find.active) {                    // the view may scroll right to it: grow before drawing
+        size_t rx = editorRowCxToRx(E.cy, E.cx);
+        editorFindRowBuffers(hlRowBytes() + (rx > E.coloff ? rx - E.coloff : 0) * 4);
+    }
+}
+
+void editorFindForget(size_t keep) {        // sets of prefixes longer than keep are out of date
+    size_t k;
+    for (k = keep + 1; k <= FIND_MAX; k++) E.find.sets[k].valid = 0;
+    E.find.set = NULL;
+}
+
+void editorFindStart(void) {               // open the prompt
+    E.find.active = 1;
+    E.find.len = 0;
+    E.find.error = NULL;
+    E.find.match = FIND_NONE;
+    E.find.origin = docLineStart(E.cy) + E.cx;
+    E.find.cx = E.cx;
+    E.find.cy = E.cy;
+    E.find.rowoff = E.rowoff;
+    E.find.coloff = E.coloff;
+    editorFindRowBuffers(hlRowBytes());     // now rather than while drawing
+    editorFindForget(0);                    // the document may have changed since
+}
+
+size_t editorFindIn(size_t from, size_t to, int last, size_t *end) { // the query's first or last match
+    struct finder *f = &E.find;
+    struct regex *re = NULL;
+    size_t hit = FIND_NONE, n, k, bytes = 0;
+    if (f->regex) {
+        re = reGet(f->query, f->len);
+        f->error = re ? NULL : reError;
+        if (re == NULL) return FIND_NONE;
+    }
+    n = triNarrow(f->query, f->len, f->regex, from, to); // all of it unless the index says less
+    for (k = 0; k < n; k++) bytes += TI.ranges[2 * k + 1] - TI.ranges[2 * k];
+    if (SP.numthreads > 1 && bytes >= SEARCH_MIN) // big: spread over the pool
+        return searchFirst(f->query, f->len, f->regex, last, from, to, end);
+    for (k = 0; k < n && hit == FIND_NONE; k++) {
+        size_t i = last ? n - 1 - k : k, lo = TI.ranges[2 * i], hi = TI.ranges[2 * i + 1];
+        if (re) hit = last ? docRegexFindLast(NULL, re, lo, hi, end) : docRegexFind(NULL, re, lo, hi, end);
+        else hit = last ? docFindLast(NULL, f->query, f->len, lo, hi) : docFind(NULL, f->query, f->len, lo, hi);
+    }
+    if (re == NULL) *end = hit + f->len;
+    return hit;
+}
+
+struct findSet *editorFindSet(void) {       // every match of the query, or NULL if it takes a search
+    struct finder *f = &E.find;
+    char buf[FIND_MAX];
+    size_t k = f->len, i, last = 0;
+    if (f->regex || f->len == 0) return NULL;
+    if (f->sets[k].valid) return &f->sets[k]; // backspace: kept from before
+    while (k > 0 && !f->sets[k].valid) k--; // a shorter prefix's: the query can only match there
+    if (k == 0) return NULL;
+    struct findSet *from = &f->sets[k], *to = &f->sets[f->len];
+    findSetReserve(to, from->n);
+    to->n = to->matches = 0;
+    for (i = 0; i < from->n; i++) {
+        size_t p = from->pos[i];
+        if (docRead(p + k, buf, f->len - k) != f->len - k || memcmp(buf, f->query + k, f->len - k)) continue;
+        to->pos[to->n++] = p;
+        if (p >= last) {                    // as editorFindRow() marks them
+            to->matches++;
+            last = p + f->len;
         }
-      }
     }
-    return '\x1b';
-  } else {
-    return c;
-  }
+    to->valid = 1;
+    return to;
 }
 
-int getCursorPosition(int *rows, int *cols { // get cursor position from terminal
-    char buf[32];                              // response buffer
-    unsigned int i = 0;                        // buffer index
+void editorFindStep(int forward, size_t from) { // next match at or after from, or last before it
+    struct finder *f = &E.find;
+    size_t len = docLength(), hit;
+    if ((f->set = editorFindSet()) != NULL) { // look it up instead
+        size_t lo = 0, hi = f->set->n, *pos = f->set->pos;
+        while (lo < hi) {                   // first match at or after from
+            size_t mid = lo + (hi - lo) / 2;
+            if (pos[mid] < from) lo = mid + 1;
+            else hi = mid;
+        }
+        if (f->set->n == 0) hit = FIND_NONE;
+        else if (forward) hit = pos[lo < f->set->n ? lo : 0];
+        else hit = pos[lo > 0 ? lo - 1 : f->set->n - 1];
+        f->matchend = hit + f->len;
+        f->match = hit;
+        if (hit != FIND_NONE) editorJumpTo(hit);
+        searchCancel(SEARCH_COUNT);         // counted already, a shorter query's count is no use
+        return;
+    }
+    if (forward) {
+        hit = editorFindIn(from, len, 0, &f->matchend);
+        if (hit == FIND_NONE && !f->error) hit = editorFindIn(0, from, 0, &f->matchend); // wrap around
+    } else {
+        hit = editorFindIn(0, from, 1, &f->matchend);
+        if (hit == FIND_NONE && !f->error) hit = editorFindIn(from, len, 1, &f->matchend);
+    }
+    f->match = hit;
+    if (hit != FIND_NONE) editorJumpTo(hit);
+    if (!f->error) searchCountStart(f->query, f->len, f->regex); // after the first match is on screen
+}
 
-    write(STDOUT_FILENO, "\x1b[6n", 4);        // request cursor position
+void editorFindCollect(void) {              // keep a finished count's matches for the next keys
+    struct finder *f = &E.find;
+    if (!f->active || f->regex || f->len == 0 || f->sets[f->len].valid) return;
+    if (searchTakeHits(f->query, f->len, &f->sets[f->len])) f->set = &f->sets[f->len];
+}
 
-    while (i < sizeof(buf) - 1) {              // read response
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break; // stop on failure
-        if (buf[i] == 'R') break;               // 'R' marks end of response
-        i++;
+void editorFindRow(size_t pos, size_t linelen, size_t n, unsigned char *attr) { // mark matches in a line's first n bytes
+    struct finder *f = &E.find;
+    size_t at = 0, s, e;
+    const char *hit;
+    struct regex *re = NULL;
+    if (f->len == 0 || f->error || (f->regex && (re = reGet(f->query, f->len)) == NULL)) return;
+    docRead(pos, f->rowtext, n);
+    while (at <= n) {
+        if (re) {                           // ^ only at the start, $ only if the line ends on screen
+            if (!reSearch(re, f->rowtext + at, n - at, at == 0, n == linelen, &s, &e)) break;
+            s += at;
+            e += at;
+        } else {
+            if ((hit = findScan(f->rowtext + at, n - at, f->query, f->len)) == NULL) break;
+            s = hit - f->rowtext;
+            e = s + f->len;
+        }
+        memset(attr + s, ATTR_MATCH, e - s);
+        at = e > s ? e : s + 1;
     }
+}
 
-    buf[i] = '\0';                             // null-terminate response
+void editorFindAppend(const char *s, size_t n) { // typed or pasted into the query
+    struct finder *f = &E.find;
+    if (n > FIND_MAX - f->len) n = FIND_MAX - f->len;
+    editorFindForget(f->len);               // longer prefixes were typed before, differently
+    memcpy(f->query + f->len, s, n);
+    f->len += n;
+    editorFindStep(1, f->origin);
+}
 
-    if (buf[0] != '\x1b' || buf[1] != '[') return -1; // validate escape sequence
-    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1; // parse row/col
+int editorFindKey(int c) {                  // prompt key, 0 if the editor should handle it
+    struct finder *f = &E.find;
+    char buf[4];
+    if (c & KEY_UNICODE) {
+        editorFindAppend(buf, utf8Encode(c & ~KEY_UNICODE, buf));
+        return 1;
+    }
+    if ((c & KEY_ALT) && (c & ~KEY_MODS) < 256) return 1;
+    c &= ~KEY_MODS;
+    switch (c) {
+        case CURSOR_REPORT:                 // terminal replies are not keys
+        case MODE_REPORT:
+        case CTRL_KEY('q'):
+            return 0;
+        case '\r':                          // stay at the match
+            f->active = 0;
+            searchCancel(SEARCH_COUNT);     // edits may follow
+            break;
+        case '\x1b':                        // back to where the search started
+            f->active = 0;
+            searchCancel(SEARCH_COUNT);
+            E.cx = f->cx;
+            E.cy = f->cy;
+            E.rowoff = f->rowoff;
+            E.coloff = f->coloff;
+            break;
+        case BACKSPACE:
+        case CTRL_KEY('h'):
+        case DEL_KEY:
+            if (f->len == 0) break;
+            do f->len--; while (f->len > 0 && isUtf8Cont((unsigned char)f->query[f->len]));
+            f->error = NULL;
+            if (f->len) {
+                editorFindStep(1, f->origin);
+            } else {
+                f->match = FIND_NONE;
+                f->set = NULL;
+                searchCancel(SEARCH_COUNT);
+            }
+            break;
+        case CTRL_KEY('r'):                 // plain text or regex
+            f->regex = !f->regex;
+            f->error = NULL;
+            if (f->len) editorFindStep(1, f->origin);
+            break;
+        case ARROW_DOWN:
+        case ARROW_RIGHT:
+        case CTRL_KEY('f'):
+            if (f->len) editorFindStep(1, f->match != FIND_NONE ? f->match + 1 : f->origin);
+            break;
+        case ARROW_UP:
+        case ARROW_LEFT:
+            if (f->len) editorFindStep(0, f->match != FIND_NONE ? f->match : f->origin);
+            break;
+        case PASTE_START: {                 // first line of the paste
+            size_t n;
+            char *p = inputPaste(&n), *nl = memchr(p, '\n', n), *cr = memchr(p, '\r', n);
+            if (nl) n = nl - p;
+            if (cr && (size_t)(cr - p) < n) n = cr - p;
+            editorFindAppend(p, n);
+            free(p);
+            break;
+        }
+        default:
+            if (c == '\t' || (c < 256 && !iscntrl(c))) {
+                buf[0] = c;
+                editorFindAppend(buf, 1);
+            }
+            break;
+    }
+    return 1;
+}
 
-    return 0;                                  // success
+/*** File I/O ***/
+void editorClose(void) {                   // drop the document and its mapping
+    searchCancel(SEARCH_FIRST);             // no thread is reading it
+    searchCancel(SEARCH_COUNT);
+    triClose();                             // the builder reads the mapping
+    docFree();
+    hlReset();
+    if (E.filemap) munmap(E.filemap, E.filemaplen);
+    E.filemap = NULL;
+    E.filemaplen = 0;
 }
 
-int getWindowSize(int *rows, int *cols) { // get terminal size
-    struct winsize ws;                     // window size struct
+void editorOpen(const char *filename) {    // map a file as the original buffer
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+    struct stat st;
+    if (fstat(fd, &st) == -1) die("fstat");
 
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) { // ioctl failed
-        write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12); // move cursor bottom-right
-        return getCursorPosition(rows, cols);          // infer size via cursor
-    } else {
-        *cols = ws.ws_col;                  // store columns
-        *rows = ws.ws_row;                  // store rows
-        return 0;
+    void *map = NULL;
+    size_t len = st.st_size;
+    if (len) {                             // pages fault in as they are drawn
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) die("mmap");
     }
+    close(fd);                             // the mapping keeps the file alive
+
+    editorClose();
+    free(E.filename);
+    E.filename = strdup(filename);
+    E.filemap = map;
+    E.filemaplen = len;
+    docInit(map, len, E.workerpipe[1]);
+    triOpen(filename, map, len, &st, E.workerpipe[1]);
+    hlSelect(filename);
 }
 
 /*** Append Buffer ***/
-struct abuf {
-    char *b;                                // pointer to buffer
-    int len;                                // buffer length
-};
+/* The frame buffer is an arena kept for the whole session: it doubles when
+   a frame outgrows it and is only reset between frames, so steady-state
+   frame building does not touch the heap. */
+void abReset(struct abuf *ab) {             // start a new frame, keep the memory
+    ab->len = 0;
+}
 
-#define ABUF_INIT {NULL, 0}                 // initialize empty buffer
+int abReserve(struct abuf *ab, int len) {   // room for len more bytes
+    if (ab->len + len <= ab->cap) return 1;
+    int cap = ab->cap ? ab->cap : ABUF_MIN;
+    while (cap < ab->len + len) cap *= 2;   // geometric growth
+    char *new = realloc(ab->b, cap);        // resize buffer
+    if (new == NULL) return 0;              // abort on allocation failure
+    ab->b = new;                            // update buffer pointer
+    ab->cap = cap;
+    ab->grows++;
+    return 1;
+}
 
 void abAppend(struct abuf *ab, const char *s, int len) { // append data to buffer
-    char *new = realloc(ab->b, ab->len + len); // resize buffer
-    if (new == NULL) return;                    // abort on allocation failure
-    memcpy(&new[ab->len], s, len);              // copy new data
-    ab->b = new;                                // update buffer pointer
-    ab->len += len;                             // update length
+    if (!abReserve(ab, len)) return;
+    memcpy(&ab->b[ab->len], s, len);        // copy new data
+    ab->len += len;                         // update length
+}
+
+void abAppendFill(struct abuf *ab, char c, int n) { // append n copies of c
+    if (!abReserve(ab, n)) return;
+    memset(&ab->b[ab->len], c, n);
+    ab->len += n;
 }
 
 void abFree(struct abuf *ab) {              // free append buffer
     free(ab->b);                             // release memory
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
 }
 
-/*** Input Handling ***/
+/*** Screen Grid ***/
+/* Frames are drawn into the back grid and compared with the front grid,
+   which mirrors the terminal. Only changed cells are sent, joined by the
+   cheapest cursor motion, and a row whose tail became blank is cut with
+   a single erase-to-end-of-line. When the text moved vertically, the
+   terminal scrolls it first, so only the rows it exposed differ. */
+
+struct cell *gridRow(struct cell *frame, int row) { // first cell of a row
+    return frame + (size_t)row * E.grid.cols;
+}
+
+void gridResize(int rows, int cols) {        // (re)allocate the front frame, keeping what survives
+    struct screenGrid *g = &E.grid;
+    struct cell *front = malloc(sizeof(struct cell) * rows * cols);
+    int r, c;
+    if (front == NULL) die("malloc");
+
+    /* On the alternate screen a resize keeps the top-left text in place,
+       unless narrowing reflows the lines or the cursor row fell off the
+       bottom and the terminal scrolled. Otherwise only new cells are
+       unknown; len 0 never matches a drawn cell, so just those get sent. */
+    int keep = g->valid && cols >= g->cols && g->cy >= 0 && g->cy < rows;
+    for (r = 0; keep && r < rows; r++) {
+        struct cell *row = front + (size_t)r * cols;
+        c = 0;
+        if (r < g->rows) {
+            memcpy(row, gridRow(g->front, r), sizeof(struct cell) * g->cols);
+            c = g->cols;
+        }
+        for (; c < cols; c++) row[c].len = 0;
+    }
+
+    free(g->front);
+    g->front = front;
+    g->rows = rows;
+    g->cols = cols;
+    g->valid = keep;                         // otherwise repaint everything next frame
+    abReserve(&E.frame, rows * cols * ABUF_CELL); // a screen of colored text, without growing later
+}
+
+void cellSet(struct cell *c, const char *s, int len, int attr) {
+    memcpy(c->ch, s, len);
+    c->len = len;
+    c->attr = attr;
+}
+
+struct attrStyle {                           // SGR state behind an ATTR_*
+    unsigned char fg, bg;                    // color parameter, 0 for the default
+    unsigned char bold, underline, inverse;
+};
+
+const struct attrStyle attrStyles[] = {
+    [ATTR_NORMAL] = {0, 0, 0, 0, 0},
+    [ATTR_INVERSE] = {0, 0, 0, 0, 1},
+    [ATTR_COMMENT] = {36, 0, 0, 0, 0},
+    [ATTR_KEYWORD1] = {33, 0, 0, 0, 0},
+    [ATTR_KEYWORD2] = {32, 0, 0, 0, 0},
+    [ATTR_STRING] = {35, 0, 0, 0, 0},
+    [ATTR_NUMBER] = {31, 0, 0, 0, 0},
+    [ATTR_MATCH] = {30, 43, 0, 0, 0},
+};
+
+int attrBlankSame(int a, int b) {            // a space looks alike: only fg and bold differ
+    const struct attrStyle *x = &attrStyles[a], *y = &attrStyles[b];
+    return x->bg == y->bg && x->underline == y->underline && x->inverse == y->inverse;
+}
+
+int cellShowsIn(const struct cell *c, int attr) { // right if written while attr is set
+    return c->attr == attr || (c->len == 1 && c->ch[0] == ' ' && attrBlankSame(c->attr, attr));
+}
+
+int cellEqual(const struct cell *a, const struct cell *b) { // same on screen
+    return a->len == b->len && memcmp(a->ch, b->ch, a->len) == 0 && cellShowsIn(a, b->attr);
+}
+
+int cellBlank(const struct cell *c) {         // what erase-to-end-of-line leaves
+    return c->len == 1 && c->ch[0] == ' ' && c->attr == ATTR_NORMAL;
+}
+
+void gridClearRow(struct cell *row, int from, int to, int attr) { // fill with spaces
+    for (; from < to; from++) cellSet(&row[from], " ", 1, attr);
+}
+
+int gridPutString(struct cell *row, int col, const char *s, int len, int attr) { // ASCII text
+    for (; len > 0 && col < E.screencols; len--, s++) cellSet(&row[col++], s, 1, attr);
+    return col;
+}
+
+int attrDelta(char *p, const struct attrStyle *from, const struct attrStyle *to) {
+    int n = 0;                               // ";"-led SGR parameters turning from into to
+    if (from->bold != to->bold) n += sprintf(p + n, ";%d", to->bold ? 1 : 22);
+    if (from->underline != to->underline) n += sprintf(p + n, ";%d", to->underline ? 4 : 24);
+    if (from->inverse != to->inverse) n += sprintf(p + n, ";%d", to->inverse ? 7 : 27);
+    if (from->fg != to->fg) n += sprintf(p + n, ";%d", to->fg ? to->fg : 39);
+    if (from->bg != to->bg) n += sprintf(p + n, ";%d", to->bg ? to->bg : 49);
+    return n;
+}
+
+void gridSetAttr(struct abuf *ab, int attr) { // switch terminal attribute, fewest bytes
+    char delta[32], reset[32], buf[40];
+    if (E.grid.attr == attr) return;
+    int dlen = attrDelta(delta, &attrStyles[E.grid.attr], &attrStyles[attr]) - 1;
+    if (dlen < 0) {                          // looks the same already
+        E.grid.attr = attr;
+        return;
+    }
+    int rlen = attrDelta(reset + 1, &attrStyles[ATTR_NORMAL], &attrStyles[attr]); // "0;..."
+    reset[0] = '0';
+    if (rlen == 0) rlen = -1;                // plain is just "\x1b[m"
+    if (rlen < dlen) abAppend(ab, buf, snprintf(buf, sizeof(buf), "\x1b[%.*sm", rlen + 1, reset));
+    else abAppend(ab, buf, snprintf(buf, sizeof(buf), "\x1b[%sm", delta + 1));
+    E.grid.attr = attr;
+}
+
+void gridMoveTo(struct abuf *ab, int row, int col) { // cheapest cursor motion
+    struct screenGrid *g = &E.grid;
+    char best[32], alt[32];
+    int bestlen, altlen, j;
+    if (g->cy == row && g->cx == col) return;
+
+    if (col == 0) bestlen = snprintf(best, sizeof(best), "\x1b[%dH", row + 1); // absolute
+    else bestlen = snprintf(best, sizeof(best), "\x1b[%d;%dH", row + 1, col + 1);
+
+    if (g->cy >= 0 && g->cx >= 0) {          // relative motion from a known position
+        int dy = row - g->cy, x = g->cx;
+        altlen = 0;
+        if (dy > 0 && dy <= 3) while (dy--) alt[altlen++] = '\n';
+        else if (dy > 0) altlen = snprintf(alt, sizeof(alt), "\x1b[%dB", dy);
+        else if (dy < 0) altlen = snprintf(alt, sizeof(alt), "\x1b[%dA", -dy);
+        if (col == 0 && x != 0) {
+            alt[altlen++] = '\r';
+        } else if (col + 1 == x) {
+            alt[altlen++] = '\b';
+        } else if (col < x) {                // back up, or return and go forward
+            char cr[16];
+            int back = snprintf(alt + altlen, sizeof(alt) - altlen, "\x1b[%dD", x - col);
+            int fwd = snprintf(cr, sizeof(cr), "\r\x1b[%dC", col);
+            if (fwd < back) memcpy(alt + altlen, cr, fwd + 1);
+            altlen += fwd < back ? fwd : back;
+        } else if (col > x) {
+            struct cell *r = gridRow(g->back, row);
+            int n = col - x, plain = row == g->cy && n < 4; // short gap: rewrite it
+            for (j = x; plain && j < col; j++)
+                plain = r[j].len == 1 && cellShowsIn(&r[j], g->attr) && cellEqual(&r[j], &gridRow(g->front, row)[j]);
+            if (plain) for (j = x; j < col; j++) alt[altlen++] = r[j].ch[0];
+            else altlen += snprintf(alt + altlen, sizeof(alt) - altlen, "\x1b[%dC", n);
+        }
+        if (altlen < bestlen) {
+            memcpy(best, alt, altlen);
+            bestlen = altlen;
+        }
+    }
+    abAppend(ab, best, bestlen);
+    g->cy = row;
+    g->cx = col;
+}
+
+int gridRowEqual(struct cell *a, struct cell *b) { // same cells across a row
+    int c;
+    for (c = 0; c < E.grid.cols; c++) if (!cellEqual(&a[c], &b[c])) return 0;
+    return 1;
+}
+
+void gridScroll(struct abuf *ab, int top, int bot, int n) { // move rows up by n, down if n < 0
+    struct screenGrid *g = &E.grid;
+    int h = bot - top + 1, d = n > 0 ? n : -n, r, same = 0, shifted = 0;
+    char buf[32];
+    if (!g->valid || n == 0 || d >= h) return;
+
+    for (r = top; r <= bot; r++) {           // does scrolling leave less to redraw?
+        struct cell *b = gridRow(g->back, r);
+        same += gridRowEqual(b, gridRow(g->front, r));
+        if (r + n >= top && r + n <= bot) shifted += gridRowEqual(b, gridRow(g->front, r + n));
+    }
+    if (shifted <= same) return;
+
+    if (!attrBlankSame(g->attr, ATTR_NORMAL)) gridSetAttr(ab, ATTR_NORMAL); // exposed rows take its background
+    int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r",
+                       top + 1, bot + 1, d, n > 0 ? 'S' : 'T');
+    abAppend(ab, buf, len);                  // region, scroll, full screen again
+    size_t keep = sizeof(struct cell) * g->cols * (h - d);
+    if (n > 0) {
+        memmove(gridRow(g->front, top), gridRow(g->front, top + d), keep);
+        for (r = bot - d + 1; r <= bot; r++) gridClearRow(gridRow(g->front, r), 0, g->cols, ATTR_NORMAL);
+    } else {
+        memmove(gridRow(g->front, top + d), gridRow(g->front, top), keep);
+        for (r = top; r < top + d; r++) gridClearRow(gridRow(g->front, r), 0, g->cols, ATTR_NORMAL);
+    }
+    g->cy = g->cx = 0;                       // setting the region homes the cursor
+}
+
+void gridFlush(struct abuf *ab) {            // emit the back grid's changes
+    struct screenGrid *g = &E.grid;
+    int r, c;
+    if (!g->valid) {                         // unknown terminal contents: start blank
+        abAppend(ab, "\x1b[m\x1b[H\x1b[2J", 10);
+        for (r = 0; r < g->rows; r++) gridClearRow(gridRow(g->front, r), 0, g->cols, ATTR_NORMAL);
+        g->cy = g->cx = 0;
+        g->attr = ATTR_NORMAL;
+        g->valid = 1;
+    }
+    for (r = 0; r < g->rows; r++) {
+        struct cell *f = gridRow(g->front, r), *b = gridRow(g->back, r);
+        int blank = g->cols;                 // back row is blank from here on
+        while (blank > 0 && cellBlank(&b[blank - 1])) blank--;
+        for (c = 0; c < g->cols; c++) {
+            if (cellEqual(&f[c], &b[c])) continue;
+            gridMoveTo(ab, r, c);
+            if (c >= blank) {                // rest of the row is blank now
+                if (!attrBlankSame(g->attr, ATTR_NORMAL)) gridSetAttr(ab, ATTR_NORMAL);
+                abAppend(ab, "\x1b[K", 3);
+                gridClearRow(f, c, g->cols, ATTR_NORMAL);
+                break;
+            }
+            if (!cellShowsIn(&b[c], g->attr)) gridSetAttr(ab, b[c].attr); // spaces keep any fg
+            int run = 1;                     // changed run of one byte, e.g. padding
+            while (b[c].len == 1 && c + run < blank && cellEqual(&b[c + run], &b[c]) &&
+                   !cellEqual(&f[c + run], &b[c + run])) run++;
+            if (run > 1) abAppendFill(ab, b[c].ch[0], run);
+            else abAppend(ab, b[c].ch, b[c].len);
+            memcpy(&f[c], &b[c], sizeof(struct cell) * run);
+            c += run - 1;
+            g->cx = c + 1 < g->cols ? c + 1 : -1; // last column leaves a pending wrap
+        }
+    }
+}
+
+void editorSetSize(int rows, int cols) {      // re-layout for a new terminal size
+    if (rows < 2) rows = 2;                   // one text row and the status bar
+    if (cols < 1) cols = 1;
+    if (rows == E.screenrows + 1 && cols == E.screencols) return; // cached size still right
+    E.screenrows = rows - 1;                  // room for the status bar
+    E.screencols = cols;
+    E.dirty = 1;
+}
+
+/*** Render Thread ***/
+/* Terminal output runs on its own thread, so a congested pty never holds
+   up input. The main thread draws each frame into a snapshot of the
+   visible rows and queues it on a lock-free single-producer/single-
+   consumer ring; from then on the snapshot is read-only. The render thread
+   owns E.grid, E.frame and E.stats: it diffs the newest snapshot against
+   the front grid, writes the bytes and hands the snapshot back on a second
+   ring. While every snapshot is in flight the main thread keeps applying
+   keys, and their changes go out together in the next frame. */
+#define RENDER_SNAPSHOTS 3                  // one being drawn, one queued, one being sent
+#define RENDER_RING 8                       // slots per ring, a power of two
+
+enum renderOp { RENDER_FRAME, RENDER_QUERY, RENDER_STOP };
+
+struct snapshot {                           // one frame, immutable once queued
+    struct cell *cells;                     // rows * cols, status bar last
+    int rows, cols;
+    int cy, cx;                             // cursor on screen
+    size_t rowoff;                          // first document line shown
+    int sync;                               // wrap in a synchronized update
+};
+
+struct renderCmd {
+    int op;                                 // RENDER_*
+    struct snapshot *snap;                  // RENDER_FRAME
+    const char *s;                          // RENDER_QUERY: bytes to send
+    int len;
+};
+
+struct renderRing {                         // lock-free, one producer, one consumer
+    struct renderCmd slot[RENDER_RING];
+    unsigned head;                          // advanced by the producer only
+    unsigned tail;                          // advanced by the consumer only
+};
+
+struct renderThread {
+    struct renderRing todo;                 // main -> render: frames and queries
+    struct renderRing done;                 // render -> main: snapshots to reuse
+    struct snapshot snaps[RENDER_SNAPSHOTS];
+    unsigned long queued;                   // commands pushed, main thread only
+    unsigned long finished;                 // commands completed, published by the thread
+    int starved;                            // main is waiting for a snapshot
+    int notifyfd;                           // written when a starved main gets one
+    int wake[2];                            // the thread blocks reading wake[0]
+    size_t shownoff;                        // rowoff of the frame on screen
+    pthread_t thread;
+    int running;                            // thread was started
+};
+
+struct renderThread R;                      // the editor's output side
+
+int ringPush(struct renderRing *r, const struct renderCmd *cmd) { // producer, 0 when full
+    unsigned head = r->head;
+    if (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) == RENDER_RING) return 0;
+    r->slot[head % RENDER_RING] = *cmd;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE); // publish after the slot
+    return 1;
+}
+
+struct renderCmd *ringPeek(struct renderRing *r, unsigned i) { // consumer, NULL past the end
+    unsigned tail = r->tail;
+    if (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) - tail <= i) return NULL;
+    return &r->slot[(tail + i) % RENDER_RING];
+}
+
+void ringPop(struct renderRing *r) {        // consumer is done with the oldest slot
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+struct cell *snapRow(struct snapshot *s, int row) { // first cell of a snapshot row
+    return s->cells + (size_t)row * s->cols;
+}
+
+void renderFrame(struct snapshot *s) {      // render thread: diff a snapshot onto the terminal
+    struct screenGrid *g = &E.grid;
+    struct abuf *ab = &E.frame;               // reuse the frame arena
+    abReset(ab);
+    if (s->rows != g->rows || s->cols != g->cols) gridResize(s->rows, s->cols);
+    g->back = s->cells;
+
+    if (s->sync) abAppend(ab, "\x1b[?2026h", 8); // terminal shows the frame whole
+    abAppend(ab, "\x1b[?25l", 6);              // hide cursor
+    int head = ab->len;
+
+    gridScroll(ab, 0, s->rows - 2, (int)(s->rowoff - R.shownoff)); // text only, not the status bar
+    R.shownoff = s->rowoff;
+    gridFlush(ab);                             // diff against the front grid
+    int changed = ab->len > head;
+    if (!changed) ab->len = 0;                 // nothing changed: keep the cursor shown
+
+    gridMoveTo(ab, s->cy, s->cx);
+    if (changed) {
+        abAppend(ab, "\x1b[?25h", 6);          // show cursor
+        if (s->sync) abAppend(ab, "\x1b[?2026l", 8); // end of the update
+    }
+
+    termWrite(ab->b, ab->len);                 // the whole frame, even if the tty is slow
+    g->back = NULL;
+    E.stats.frames++;
+    E.stats.bytes += ab->len;
+    E.stats.last = ab->len;
+}
+
+void renderRun(struct renderCmd *cmd) {     // carry out one command
+    if (cmd->op == RENDER_QUERY) {
+        termWrite(cmd->s, cmd->len);
+        E.grid.cy = E.grid.cx = -1;         // the cursor moved behind the grid's back
+        return;
+    }
+    struct renderCmd *next = ringPeek(&R.todo, 1); // inline, the ring stays empty
+    if (next == NULL || next->op != RENDER_FRAME) renderFrame(cmd->snap); // skip frames already stale
+    ringPush(&R.done, cmd);                 // never full: it has a slot per snapshot
+    __atomic_thread_fence(__ATOMIC_SEQ_CST); // pairs with the fence in renderTake()
+    if (__atomic_exchange_n(&R.starved, 0, __ATOMIC_SEQ_CST) && R.notifyfd != -1)
+        write(R.notifyfd, "r", 1);          // a full pipe is wakeup enough
+}
+
+void *renderWorker(void *arg) {             // the render thread
+    char buf[64];
+    (void)arg;
+    while (1) {
+        struct renderCmd *cmd = ringPeek(&R.todo, 0);
+        if (cmd == NULL) {                  // sleep until renderPush() writes a byte
+            if (read(R.wake[0], buf, sizeof(buf)) == -1 && errno != EINTR) die("read");
+            continue;
+        }
+        int op = cmd->op;
+        if (op != RENDER_STOP) renderRun(cmd);
+        ringPop(&R.todo);
+        __atomic_store_n(&R.finished, R.finished + 1, __ATOMIC_RELEASE);
+        if (op == RENDER_STOP) return NULL;
+    }
+}
+
+void renderPush(struct renderCmd *cmd) {    // main thread: hand a command over
+    struct timespec ts = {0, 100000};
+    if (!R.running) {                       // no thread: render inline
+        renderRun(cmd);
+        return;
+    }
+    while (!ringPush(&R.todo, cmd)) nanosleep(&ts, NULL); // only a burst of queries fills it
+    R.queued++;
+    if (write(R.wake[1], "r", 1) == -1 && errno != EAGAIN) die("write");
+}
+
+struct snapshot *renderTake(void) {         // main thread: a snapshot to draw into, or NULL
+    struct renderCmd *cmd = ringPeek(&R.done, 0);
+    if (cmd == NULL) {
+        __atomic_store_n(&R.starved, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST); // look again after asking to be woken
+        if ((cmd = ringPeek(&R.done, 0)) == NULL) return NULL;
+        __atomic_store_n(&R.starved, 0, __ATOMIC_SEQ_CST);
+    }
+    struct snapshot *s = cmd->snap;
+    ringPop(&R.done);
+    if (s->rows != E.screenrows + 1 || s->cols != E.screencols) { // laid out for another size
+        s->rows = E.screenrows + 1;
+        s->cols = E.screencols;
+        s->cells = realloc(s->cells, sizeof(struct cell) * s->rows * s->cols);
+        if (s->cells == NULL) die("realloc");
+    }
+    return s;
+}
+
+void renderSync(void) {                     // wait until everything queued has been sent
+    struct timespec ts = {0, 20000};
+    while (__atomic_load_n(&R.finished, __ATOMIC_ACQUIRE) != R.queued) nanosleep(&ts, NULL);
+}
+
+void renderStop(void) {                     // finish queued output and end the thread
+    struct renderCmd cmd = {RENDER_STOP, NULL, NULL, 0};
+    if (!R.running || pthread_equal(pthread_self(), R.thread)) return; // die() on the thread
+    renderPush(&cmd);
+    pthread_join(R.thread, NULL);
+    R.running = 0;
+}
+
+void renderStart(int notifyfd) {            // free snapshots, then the thread if we can
+    int i;
+    R.notifyfd = notifyfd;
+    for (i = 0; i < RENDER_SNAPSHOTS; i++) {
+        struct renderCmd cmd = {RENDER_FRAME, &R.snaps[i], NULL, 0};
+        ringPush(&R.done, &cmd);
+    }
+    if (pipe(R.wake) == -1) die("pipe");    // blocking reads: the thread sleeps in read()
+    fcntl(R.wake[1], F_SETFL, fcntl(R.wake[1], F_GETFL) | O_NONBLOCK);
+    for (i = 0; i < 2; i++) fcntl(R.wake[i], F_SETFD, FD_CLOEXEC);
+    if (pthread_create(&R.thread, NULL, renderWorker, NULL) == 0) {
+        R.running = 1;
+        atexit(renderStop);                 // before disableRawMode() leaves the screen
+    }
+}
 
+void requestCursorPosition(void) {         // ask where the bottom-right corner is
+    struct renderCmd cmd = {RENDER_QUERY, NULL, "\x1b[999C\x1b[999B\x1b[6n", 16};
+    E.in.cprwait = 1;
+    renderPush(&cmd);                       // reply decodes as CURSOR_REPORT
+}
 
+void requestSyncSupport(void) {            // DECRQM for synchronized output (mode 2026)
+    struct renderCmd cmd = {RENDER_QUERY, NULL, "\x1b[?2026$p", 9};
+    renderPush(&cmd);                       // reply decodes as MODE_REPORT; old terminals ignore it
+}
 
+/*** Input Handling ***/
 void editorMoveCursor(int key) {
   switch (key) {
     case ARROW_LEFT:
       if (E.cx != 0) {
-        E.cx--;
+        do E.cx--; while (E.cx > 0 &&
+            isUtf8Cont(editorByteAt(docLineStart(E.cy) + E.cx)));
+      } else if (E.cy > 0) {
+        E.cy--;
+        E.cx = editorLineLen(E.cy);
       }
       break;
     case ARROW_RIGHT:
-      if (E.cx != E.screencols - 1) {
-        E.cx++;
+      if (E.cx < editorLineLen(E.cy)) {
+        size_t start = docLineStart(E.cy);
+        do E.cx++; while (isUtf8Cont(editorByteAt(start + E.cx)));
+      } else if (editorLineExists(E.cy + 1)) {
+        E.cy++;
+        E.cx = 0;
       }
       break;
     case ARROW_UP:
@@ -183,24 +4730,34 @@ void editorMoveCursor(int key) {
       }
       break;
     case ARROW_DOWN:
-      if (E.cy != E.screenrows - 1) {
+      if (editorLineExists(E.cy + 1)) {
         E.cy++;
       }
       break;
   }
-}
-
-
-
-
-
 
+  size_t start = docLineStart(E.cy), len = docLineEnd(start) - start;
+  if (E.cx > len) E.cx = len;                       // snap to the end of a shorter line
+  while (E.cx > 0 && isUtf8Cont(editorByteAt(start + E.cx))) E.cx--;
+}
 
-void editorProcessKeypress(void) {           // handle keypress
-    int  c = editorReadKey();                // read key
+void editorProcessKeypress(int c) {          // handle keypress
+    if (c == KEY_NONE) return;               // a dropped sequence used up the input
+    if (E.find.active && editorFindKey(c)) return; // typing into the search prompt
+    if (c & KEY_UNICODE) {                   // non-ASCII text
+        editorInsertChar(c & ~KEY_UNICODE);
+        return;
+    }
+    if ((c & KEY_ALT) && (c & ~KEY_MODS) < 256) return; // no Alt bindings yet
+    c &= ~KEY_MODS;                          // modifiers do not change these keys yet
 
     switch (c) {
+        case '\r':                           // Enter splits the line
+            editorInsertNewline();
+            break;
+
         case CTRL_KEY('q'):                  // Ctrl-Q pressed
+            renderStop();                       // let the last frame finish
             write(STDOUT_FILENO, "\x1b[2J", 4); // clear screen
             write(STDOUT_FILENO, "\x1b[H", 3);  // move cursor home
             exit(0);                            // exit editor
@@ -209,9 +4766,29 @@ void editorProcessKeypress(void) {           // handle keypress
             E.cx = 0;
              break;
         case END_KEY:
-             E.cx = E.screencols - 1;
+             E.cx = editorLineLen(E.cy);
              break;
-            
+
+        case BACKSPACE:
+        case CTRL_KEY('h'):
+        case DEL_KEY:
+            if (c == DEL_KEY) {              // delete forward: step over the char first
+                if (docLineStart(E.cy) + E.cx >= docLength()) break;
+                editorMoveCursor(ARROW_RIGHT);
+            }
+            editorDelChar();
+            break;
+
+        case PAGE_UP:
+        case PAGE_DOWN:
+            {
+                if (c == PAGE_UP) E.cy = E.rowoff;
+                else E.cy = E.rowoff + E.screenrows - 1;
+                while (E.cy > 0 && !editorLineExists(E.cy)) E.cy--; // clamp to last line
+                int times = E.screenrows;
+                while (times--) editorMoveCursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+            }
+            break;
 
        case ARROW_UP:
        case ARROW_DOWN:
@@ -220,72 +4797,354 @@ void editorProcessKeypress(void) {           // handle keypress
         editorMoveCursor(c);
         break;
 
+        case PASTE_START:                    // the whole paste has been set aside
+            editorPaste();
+            break;
+
+        case MODE_REPORT:                    // DECRQM answer: 1 set, 2 reset, 3 always set
+            if (E.in.params[0] == 2026) E.syncoutput = E.in.params[1] >= 1 && E.in.params[1] <= 3;
+            break;
+
+        case CURSOR_REPORT:                  // answer to requestCursorPosition()
+            editorSetSize(E.in.params[0], E.in.params[1]);
+            break;
+
+        case CTRL_KEY('f'):
+            editorFindStart();
+            break;
+
+        case CTRL_KEY('l'):
+        case '\x1b':
+            break;
 
+        default:
+            if (c == '\t' || (c < 256 && !iscntrl(c))) editorInsertChar(c); // text byte
+            break;
     }
    
 }
 
 /*** Output Handling ***/
-void editorDrawRows(struct abuf *ab) {        // draw editor rows
+void editorScroll(void) {                     // keep the cursor inside the window
+    E.rx = editorRowCxToRx(E.cy, E.cx);
+    if (E.cy < E.rowoff) E.rowoff = E.cy;
+    if (E.cy >= E.rowoff + E.screenrows) E.rowoff = E.cy - E.screenrows + 1;
+    if (E.rx < E.coloff) E.coloff = E.rx;
+    if (E.rx >= E.coloff + E.screencols) E.coloff = E.rx - E.screencols + 1;
+}
+
+int editorRenderRow(size_t pos, const unsigned char *hl, size_t hllen, struct cell *row) { // visible part of the line at pos
+    size_t col = 0, limit = E.coloff + E.screencols, n = 0, j = 0, b = 0;
+    const char *p = NULL;
+    int used = 0;
+
+    while (1) {
+        if (j == n) {                         // next contiguous span of text
+            if ((p = docSpan(pos, &n)) == NULL) break;
+            pos += n;
+            j = 0;
+        }
+        unsigned char c = p[j++];
+        if (c == '\n') break;
+        int attr = b < hllen ? hl[b] : ATTR_NORMAL; // class of this byte
+        b++;
+        if (isUtf8Cont(c)) {                  // belongs to the previous column, 4 bytes at most
+            if (col > E.coloff && col <= limit && row[used - 1].len < 4) row[used - 1].ch[row[used - 1].len++] = c;
+            continue;
+        }
+        if (col >= limit) break;
+        if (c == '\t') {
+            do {
+                if (col >= E.coloff) cellSet(&row[used++], " ", 1, attr);
+                col++;
+            } while (col % KILO_TAB_STOP != 0 && col < limit);
+        } else {
+            char ch = iscntrl(c) ? '?' : c;
+            if (col >= E.coloff) cellSet(&row[used++], &ch, 1, attr);
+            col++;
+        }
+    }
+    return used;
+}
+
+void editorDrawRows(struct snapshot *s) {     // draw editor rows into a snapshot
     int y;                                   // row index
+    size_t start = docLineStart(E.rowoff); // first visible line
 
     for (y = 0; y < E.screenrows; y++) {     // loop through rows
-        if (y == E.screenrows / 3) {         // draw welcome message
+        struct cell *row = snapRow(s, y);
+        int used = 0;
+        if (start != DOC_NOLINE) {            // document text
+            size_t end = docLineEnd(start);
+            struct hlRow *hl = hlRowFor(E.rowoff + y, end - start); // NULL: plain until lexed
+            const unsigned char *attr = hl ? hl->hl : NULL;
+            size_t attrlen = hl ? hl->len : 0;
+            if (E.find.active && E.find.len) { // search matches over the highlight
+                size_t n = end - start < hlRowBytes() ? end - start : hlRowBytes();
+                editorFindRowBuffers(n);
+                if (attrlen > n) attrlen = n;
+                if (attrlen) memcpy(E.find.rowattr, attr, attrlen);
+                memset(E.find.rowattr + attrlen, ATTR_NORMAL, n - attrlen);
+                editorFindRow(start, end - start, n, E.find.rowattr);
+                attr = E.find.rowattr;
+                attrlen = n;
+            }
+            used = editorRenderRow(start, attr, attrlen, row);
+            start = end < docLength() ? end + 1 : DOC_NOLINE;
+        } else if (E.filename == NULL && docLength() == 0 && y == E.screenrows / 3) { // draw welcome message
             char welcome[80];                // welcome buffer
             int welcomelen = snprintf(welcome, sizeof(welcome),
                 "Kilo editor -- version %s", KILO_VERSION); // format message
             if (welcomelen > E.screencols) welcomelen = E.screencols; // truncate
             int padding = (E.screencols - welcomelen) / 2; // center text
-            if (padding) { abAppend(ab, "~", 1); padding--; } // left tilde
-            while (padding--) abAppend(ab, " ", 1); // add spaces
-            abAppend(ab, welcome, welcomelen); // draw message
+            if (padding) used = gridPutString(row, 0, "~", 1, ATTR_NORMAL); // left tilde
+            used = gridPutString(row, padding, welcome, welcomelen, ATTR_NORMAL); // draw message
+            gridClearRow(row, 1, padding, ATTR_NORMAL); // spaces before it
         } else {
-            abAppend(ab, "~", 1);             // draw tilde on empty lines
+            used = gridPutString(row, 0, "~", 1, ATTR_NORMAL); // draw tilde on empty lines
+        }
+        gridClearRow(row, used, E.screencols, ATTR_NORMAL); // clear rest of line
+    }
+}
+
+void editorDrawStatusBar(struct snapshot *s) { // file name, size and position
+    char status[80], rstatus[80], ft[24] = "";
+    size_t lines = docLineCount();
+    struct cell *row = snapRow(s, E.screenrows);
+    int len, rlen;
+
+    if (E.hl.syntax) snprintf(ft, sizeof(ft), "%s | ", E.hl.syntax->name); // file type
+    if (E.find.active) {                     // the prompt, with the end of a long query
+        size_t shown = E.find.len < 50 ? E.find.len : 50;
+        len = snprintf(status, sizeof(status), "%s: %.*s", E.find.regex ? "Regex" : "Search",
+                       (int)shown, E.find.query + E.find.len - shown);
+        char count[32] = "";
+        if (E.find.len && !E.find.error && E.find.match != FIND_NONE && (E.find.set || SP.numthreads)) {
+            int complete = 1;                // as far as the pool has counted in order
+            size_t n = E.find.set ? E.find.set->matches : searchCounted(0, &complete);
+            snprintf(count, sizeof(count), "%zu%s match%s ", n, complete ? "" : "+", n == 1 && complete ? "" : "es");
         }
-        abAppend(ab, "\x1b[K", 3);            // clear rest of line
-        if (y < E.screenrows - 1) abAppend(ab, "\r\n", 2); // newline
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%s(Esc/Arrows/Enter/^R)", count,
+                        E.find.error ? E.find.error : E.find.len && E.find.match == FIND_NONE ? "no match" : "",
+                        E.find.error || (E.find.len && E.find.match == FIND_NONE) ? " " : "");
+    } else if (lines == DOC_UNKNOWN) {
+        len = snprintf(status, sizeof(status), "%.20s - indexing %d%%",
+                       E.filename ? E.filename : "[No Name]", E.indexshown);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s%zu/?", ft, E.cy + 1);
+    } else {
+        len = snprintf(status, sizeof(status), "%.20s - %zu lines",
+                       E.filename ? E.filename : "[No Name]", lines);
+        rlen = snprintf(rstatus, sizeof(rstatus), "%s%zu/%zu", ft, E.cy + 1, lines);
     }
+    len = gridPutString(row, 0, status, len, ATTR_INVERSE); // inverted colors
+    gridClearRow(row, len, E.screencols, ATTR_INVERSE);
+    if (E.screencols - len >= rlen)          // right-align the position
+        gridPutString(row, E.screencols - rlen, rstatus, rlen, ATTR_INVERSE);
 }
 
-void editorRefreshScreen(void) {              // redraw entire screen
-    struct abuf ab = ABUF_INIT;               // create append buffer
+int editorRefreshScreen(void) {               // queue a frame, 0 if every snapshot is in flight
+    struct snapshot *s;
+    editorScroll();                           // follow the cursor
+    if ((s = renderTake()) == NULL) return 0; // the render thread wakes us when one is free
 
-    abAppend(&ab, "\x1b[?25l", 6);             // hide cursor
-    abAppend(&ab, "\x1b[H", 3);                // move cursor home
+    E.indexshown = docProgress();              // progress shown this frame
+    editorDrawRows(s);                         // draw rows
+    editorDrawStatusBar(s);                    // draw status bar
+    s->cy = (int)(E.cy - E.rowoff);
+    s->cx = (int)(E.rx - E.coloff);
+    s->rowoff = E.rowoff;
+    s->sync = E.syncoutput;
 
-    editorDrawRows(&ab);                       // draw rows
+    struct renderCmd cmd = {RENDER_FRAME, s, NULL, 0};
+    renderPush(&cmd);                          // read-only from here on
+    return 1;
+}
 
-    char buf[32];
-    snprintf(buf, sizeof(buf),"\x1b[%d;%dH",E.cy+1,E.cx+1);
-    abAppend(&ab,buf,strlen(buf));
+void editorReportStats(void) {                // KILO_STATS=1: bytes per frame at exit
+    if (E.stats.frames == 0) return;
+    fprintf(stderr, "frames: %lu, bytes: %llu, avg: %.1f bytes/frame, last: %d, "
+            "arena: %d bytes, %lu grows\r\n", E.stats.frames, E.stats.bytes,
+            (double)E.stats.bytes / E.stats.frames, E.stats.last, E.frame.cap, E.frame.grows);
+}
+
+/*** Event Handlers ***/
+void editorHandleWinch(int sig) {             // SIGWINCH: wake the event loop
+    int saved = errno;
+    (void)sig;
+    write(E.winchpipe[1], "w", 1);            // a full pipe is wakeup enough
+    errno = saved;
+}
+
+void editorHandleBus(int sig, siginfo_t *si, void *ctx) { // SIGBUS: a mapped file shrank under us
+    const char *addr = si->si_addr, *map = E.filemap;
+    const char *msg = " was truncated by another program, its text is gone\n";
+    (void)sig;
+    (void)ctx;
+    disableRawMode();                         // any thread may fault: only async-signal-safe calls
+    if (map != NULL && addr >= map && addr < map + E.filemaplen) {
+        write(STDERR_FILENO, "kilo: ", 6);
+        write(STDERR_FILENO, E.filename, strlen(E.filename));
+        write(STDERR_FILENO, msg, strlen(msg));
+    } else {
+        write(STDERR_FILENO, "kilo: bus error\n", 16);
+    }
+    _exit(1);
+}
+
+#define RESIZE_FRAME_MS 16                    // signals within one frame share a re-layout
+
+void editorApplyResize(void) {                // one size query per burst of signals
+    int rows, cols;
+    E.resizepending = 0;
+    if (getWindowSize(&rows, &cols) == 0) editorSetSize(rows, cols);
+    else requestCursorPosition();             // answered through editorInputEvent
+}
+
+void editorResizeEvent(int fd) {              // terminal size changed
+    drainPipe(fd);
+    if (E.resizepending) return;              // already scheduled for this frame
+    E.resizepending = 1;
+    evAddTimer(RESIZE_FRAME_MS, editorApplyResize);
+}
 
+void editorWorkerEvent(int fd) {              // a background thread made progress
+    drainPipe(fd);
+    triCollect();                             // the search index may be built
+    editorFindCollect();                      // a count may have finished
+    E.dirty = 1;
+}
+
+void editorHighlightEvent(int fd) {           // the highlight worker finished a job
+    drainPipe(fd);
+    if (hlCollect(E.rowoff, E.rowoff + E.screenrows)) E.dirty = 1; // the frame asks for its rows
+    hlContinue();
+}
+
+void editorInputTimeout(void) {               // the rest of a sequence or paste never came
+    if (!inputPartial()) return;              // it did, the timer is stale
+    editorProcessKeypress(inputFlush());
+    E.dirty = 1;
+}
+
+void editorInputEvent(int fd) {               // stdin is readable, decode what it holds
+    int c;
+    (void)fd;
+    inputFill(0);                             // the block that woke us
+    do {
+        while ((c = editorReadKey()) != KEY_NONE) editorProcessKeypress(c); // every key from the block just read
+    } while (E.in.full && inputFill(0) > 0);  // a paste: take the rest before drawing
+    if (inputPartial())                       // never wait here: evWait() brings the rest or the timeout
+        evAddTimer(E.in.pasting ? INPUT_PASTE_TIMEOUT : INPUT_ESC_TIMEOUT, editorInputTimeout);
+    E.dirty = 1;
+}
 
+#define KILO_FPS 120                          // default frame cap, KILO_FPS=n to change it
+#define HL_WAIT_MS 4                          // longest a frame waits for its rows' highlight
 
+void editorFrameDue(void) {                   // the frame interval is up
+    E.framepending = 0;
+}
 
-                              
-    abAppend(&ab, "\x1b[?25h", 6);             // show cursor
+void editorHighlightDue(void) {               // stop waiting for the highlighter
+}
 
-    write(STDOUT_FILENO, ab.b, ab.len);        // write buffer to terminal
-    abFree(&ab);                               // free buffer
+void editorFrame(void) {                      // draw, at most once per frame interval
+    long long now;
+    if (!E.dirty || E.framepending) return;
+    now = evNow();
+    if (now < E.nextframe) {                  // too soon: keep taking input until then
+        E.framepending = 1;
+        evAddTimer(E.nextframe - now, editorFrameDue);
+        return;
+    }
+    editorScroll();                           // highlight the rows this frame will show
+    if (hlSchedule(E.rowoff, E.rowoff + E.screenrows) > 0) { // usually back within microseconds
+        if (E.hlwait == 0) {
+            E.hlwait = now + HL_WAIT_MS;
+            evAddTimer(HL_WAIT_MS, editorHighlightDue);
+        }
+        if (now < E.hlwait) return;           // a slow job: draw them plain after HL_WAIT_MS
+    }
+    if (!editorRefreshScreen()) return;       // still dirty, retried when a snapshot comes back
+    E.dirty = 0;
+    E.hlwait = 0;
+    E.nextframe = now + E.framems;
 }
 
 /*** Init ***/
 void initEditor(void) {                        // initialize editor
     E.cx=0;
     E.cy=0;
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1) // get terminal size
-        die("getWindowSize");                  // abort on failure
+    E.rx=0;
+    E.rowoff=0;
+    E.coloff=0;
+    E.indexshown=100;
+    E.frame=(struct abuf)ABUF_INIT;
+    E.dirty=1;
+    E.framems = 1000 / KILO_FPS;
+    if (getenv("KILO_FPS")) {                  // 0 turns the cap off
+        int fps = atoi(getenv("KILO_FPS"));
+        E.framems = fps > 0 ? 1000 / fps : 0;
+    }
+    E.nextframe=0;
+    E.framepending=0;
+    E.hlwait=0;
+    E.find.active=0;
+    E.find.regex=0;
+    E.find.rowtext=NULL;
+    E.find.rowattr=NULL;
+    E.find.rowcap=0;
+    E.filename=NULL;
+    E.filemap=NULL;
+    E.filemaplen=0;
+    nlScanInit();                              // choose the newline kernel
+    findScanInit();                            // and the substring one
+    inputInit();                               // build the key decoder tables
+    if (docSelect(getenv("KILO_BACKEND")) == -1) die("KILO_BACKEND"); // storage for documents
+    docInit(NULL, 0, -1);                      // start with an empty document
+    E.resizepending=0;
+    E.syncoutput=0;
+    makePipe(E.winchpipe);
+    makePipe(E.workerpipe);
+    hlStart();                                 // highlight worker, fed from editorFrame()
+    searchStart(getenv("KILO_THREADS") ? atoi(getenv("KILO_THREADS")) : (int)sysconf(_SC_NPROCESSORS_ONLN),
+                E.workerpipe[1]);              // search pool, reporting counts like the indexer
+    if (getenv("KILO_STATS")) atexit(editorReportStats);
+    renderStart(E.workerpipe[1]);              // terminal output from here on
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) {   // no ioctl: assume 24x80 until the terminal answers
+        rows = 24;
+        cols = 80;
+        requestCursorPosition();
+    }
+    editorSetSize(rows, cols);                 // text rows plus status bar
+    requestSyncSupport();                      // frames go out unwrapped until it answers
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleWinch;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
+    sa.sa_sigaction = editorHandleBus;         // the open file truncated while mapped
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGBUS, &sa, NULL);
+    evAddFd(STDIN_FILENO, editorInputEvent);
+    evAddFd(E.winchpipe[0], editorResizeEvent);
+    evAddFd(E.workerpipe[0], editorWorkerEvent);
+    evAddFd(E.hl.notify[0], editorHighlightEvent);
 }
 
-int main(void) {                               // program entry point
+#ifndef KILO_BENCH                             // bench.c brings its own main()
+int main(int argc, char *argv[]) {             // program entry point
     enableRawMode();                           // enable raw terminal mode
     initEditor();                              // initialize editor state
+    if (argc >= 2) editorOpen(argv[1]);        // load the file to edit
 
     while (1) {                                // main loop
-        editorRefreshScreen();                 // redraw screen
-        editorProcessKeypress();               // handle input
+        editorFrame();                         // redraw screen if a frame is due
+        evWait();                              // block until input or an event
     }
 
     return 0;                                  // unreachable
 }
-
+#endif